@@ -8,6 +8,8 @@
 #include "box3.h"
 #include "Platform.h"
 
+#include <algorithm>
+
 Box3::Box3()
 {
 	// init to negative volume
@@ -227,6 +229,46 @@ bool Box3::intersects( const vec3& p1, const vec3& p2, float64 radius ) const
     return( result );
 }
 
+float64 Box3::getRayEntry( const vec3& p1, const vec3& p2, float64 radius ) const
+{
+	vec3 v = p2 - p1;
+	float64 tMin = 0;
+	float64 tMax = 1;
+	
+	// clip against the slab of each axis
+	for( int32 i=0; i<3; ++i )
+	{
+		float64 low = mMin[ i ] - radius;
+		float64 high = mMax[ i ] + radius;
+		if (v[ i ] == 0)
+		{
+			if (p1[ i ] < low
+				|| p1[ i ] > high)
+			{
+				return( -1 );
+			}
+		}
+		else
+		{
+			float64 t1 = (low - p1[ i ]) / v[ i ];
+			float64 t2 = (high - p1[ i ]) / v[ i ];
+			if (t1 > t2)
+			{
+				std::swap( t1, t2 );
+			}
+			
+			tMin = std::max( tMin, t1 );
+			tMax = std::min( tMax, t2 );
+			if (tMin > tMax)
+			{
+				return( -1 );
+			}
+		}
+	}
+	
+	return( tMin );
+}
+
 bool Box3::contains( const Box3& box ) const
 {
 	bool result = false;
@@ -243,6 +285,61 @@ bool Box3::contains( const Box3& box ) const
 	return( result );
 }
 
+int32 Box3::classify( const Plane& plane ) const
+{
+	// projected half size of the box on the normal
+	vec3 normal = plane.getNormal();
+	float64 radius = 0;
+	for( int32 i=0; i<3; ++i )
+	{
+		radius += fabs( normal[ i ] ) * (mMax[ i ] - mMin[ i ]) / 2;
+	}
+	
+	float64 dist = dot( getCenter() - plane.getPos(), normal );
+	if (dist < -radius)
+	{
+		return( -1 );
+	}
+	
+	if (dist > radius)
+	{
+		return( 1 );
+	}
+	
+	return( 0 );
+}
+
+float64 Box3::getDist( const vec3& p ) const
+{
+	float64 distSquared = 0;
+	for( int32 i=0; i<3; ++i )
+	{
+		float64 d = 0;
+		if (p[ i ] < mMin[ i ])
+		{
+			d = mMin[ i ] - p[ i ];
+		}
+		else if (p[ i ] > mMax[ i ])
+		{
+			d = p[ i ] - mMax[ i ];
+		}
+		
+		distSquared += d * d;
+	}
+	
+	return( sqrt( distSquared ));
+}
+
+bool Box3::containsInterior( const Box3& box ) const
+{
+	return( mMin.mX < box.mMin.mX
+		&& mMin.mY < box.mMin.mY
+		&& mMin.mZ < box.mMin.mZ
+		&& mMax.mX > box.mMax.mX
+		&& mMax.mY > box.mMax.mY
+		&& mMax.mZ > box.mMax.mZ );
+}
+
 bool Box3::operator==( const Box3& right ) const
 {
     if (valid() == false
@@ -31,8 +31,21 @@ public:
 	// ray intersection
 	bool intersects( const vec3& p1, const vec3& p2, float64 radius ) const;
 	
+	// where a ray with radius enters the box, as t along p1 to p2
+	// the box is grown by radius on all sides, so the result is never
+	// later than where the ray really touches. < 0 if it misses in [0, 1]
+	float64 getRayEntry( const vec3& p1, const vec3& p2, float64 radius ) const;
+	
 	bool contains( const Box3& box ) const;
 	
+	// contains without touching any face
+	// so no box outside this one can intersect it
+	bool containsInterior( const Box3& box ) const;
+	
+	// which side of a plane the box is on
+	// 1 = all in the half space the normal points to, -1 = all out, 0 = both
+	int32 classify( const Plane& plane ) const;
+	
 	void getBoundingSphere( vec3& posOut, float32 radiusOut ) const;
 	
 	vec3 getMin() const;
@@ -40,8 +53,8 @@ public:
     
     bool operator==( const Box3& right ) const;
 	
-	// todo:
-	//bool getDist( const vec3& p ) const;
+	// distance from p to the closest point in the box, 0 inside
+	float64 getDist( const vec3& p ) const;
 	
 	// zero of positive area
 	bool valid() const;
@@ -0,0 +1,267 @@
+//
+//  concurrentocttree.h
+//
+
+#ifndef _CONCURRENTOCTTREE_H
+#define _CONCURRENTOCTTREE_H
+
+#include "octtree.h"
+#include "epoch.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+// one write to a concurrentOctTree, kept to replay on the other copy
+template< typename T >
+class TreeWrite
+{
+public:
+
+	enum Type
+	{
+		kAdd,
+		kRemove,
+		kUpdate,
+		kCombine,
+		kTick
+	};
+
+	TreeWrite( Type type, T item, const vec3& p, float64 radius )
+	{
+		mType = type;
+		mItem = item;
+		mPos = p;
+		mRadius = radius;
+	}
+
+	Type mType;
+	T mItem;
+	vec3 mPos;
+	float64 mRadius;
+};
+
+// octTree that readers query while a writer changes it
+// two copies of the tree are kept. readers see the published copy,
+// writes go to the other one and show up together at publish(). publish()
+// swaps the copies, waits out the readers of the old one through an
+// EpochManager and replays the writes on it. so voxels and items freed by
+// a write are only reused once no reader can see them, and readers never
+// lock or wait. writes do wait for a publish() in progress, which waits
+// for readers of the old version, since they go to the copy those
+// readers still see. memory and write cost are doubled, reads cost one pin.
+// items are addressed by T, so TItemIndex can't be NoItemIndex
+template< typename T, typename TItemIndex = HashItemIndex< T >,
+	typename TSplitPolicy = DistanceSplitPolicy >
+class concurrentOctTree
+{
+public:
+
+	using TTree = octTree< T, TItemIndex, TSplitPolicy >;
+
+	// one per reader thread. with EpochManager::kMaxReaders alive, a new
+	// one waits in its constructor until another is destroyed
+	// has its own mailbox, so readers don't share query state
+	class Reader
+	{
+	public:
+
+		Reader( const concurrentOctTree& tree ) :
+			mTree( tree )
+		{
+			mSlot = mTree.mEpochs.addReader();
+		}
+
+		~Reader()
+		{
+			mTree.mEpochs.removeReader( mSlot );
+		}
+
+		// calls f( tree, mailbox ) on the published tree
+		// the tree doesn't change until f returns
+		template< typename F >
+		void read( F&& f )
+		{
+			mTree.mEpochs.enter( mSlot );
+			f( *mTree.mPublished.load(), mMailbox );
+			mTree.mEpochs.exit( mSlot );
+		}
+
+		void getItems( const vec3& p, float64 radius, std::vector< T >& out )
+		{
+			read( [&]( const TTree& tree, QueryMailbox& mailbox )
+			{
+				tree.forEachItem( Box3( p, radius ), mailbox, [&out]( const T& item )
+				{
+					out.push_back( item );
+					return( true );
+				} );
+			} );
+		}
+
+		void getItems( const vec3& p1, const vec3& p2, float64 radius, std::vector< T >& out )
+		{
+			read( [&]( const TTree& tree, QueryMailbox& mailbox )
+			{
+				tree.forEachItem( p1, p2, radius, mailbox, [&out]( const T& item )
+				{
+					out.push_back( item );
+					return( true );
+				} );
+			} );
+		}
+
+		void getNearest( const vec3& p, size_t k, float64 maxDist, std::vector< T >& out )
+		{
+			read( [&]( const TTree& tree, QueryMailbox& mailbox )
+			{
+				tree.getNearest( p, k, maxDist, mailbox, out );
+			} );
+		}
+
+	private:
+
+		Reader( const Reader& ) = delete;
+		Reader& operator=( const Reader& ) = delete;
+
+		const concurrentOctTree& mTree;
+		int32 mSlot;
+		QueryMailbox mMailbox;
+	};
+
+	concurrentOctTree( const vec3& minBounds, const vec3& maxBounds, float64 minVoxelSize,
+		int32 splitThreshold = 2 )
+	{
+		for( int32 i=0; i<2; ++i )
+		{
+			mTrees[ i ].reset( new TTree( minBounds, maxBounds, minVoxelSize, splitThreshold ));
+		}
+
+		mBack = 1;
+		mPublished = mTrees[ 0 ].get();
+	}
+
+	// writes, seen by readers after the next publish()
+	// writers are serialized with each other and publish(), not with readers
+	void add( T object, const vec3& p, float64 radius )
+	{
+		write( TreeWrite< T >( TreeWrite< T >::kAdd, object, p, radius ));
+	}
+
+	bool remove( T object )
+	{
+		return( write( TreeWrite< T >( TreeWrite< T >::kRemove, object, kOrigin3, 0 )));
+	}
+
+	bool update( T object, const vec3& p, float64 radius )
+	{
+		return( write( TreeWrite< T >( TreeWrite< T >::kUpdate, object, p, radius )));
+	}
+
+	void combine()
+	{
+		write( TreeWrite< T >( TreeWrite< T >::kCombine, T(), kOrigin3, 0 ));
+	}
+
+	void tick()
+	{
+		write( TreeWrite< T >( TreeWrite< T >::kTick, T(), kOrigin3, 0 ));
+	}
+
+	// makes the writes so far visible to new reads
+	// waits for reads of the previous version, never for newer ones.
+	// writes from other threads wait until it returns
+	void publish()
+	{
+		std::lock_guard< std::mutex > lock( mWriteMutex );
+		if (mWrites.size() == 0)
+		{
+			return;
+		}
+
+		mPublished = mTrees[ mBack ].get();
+		mBack ^= 1;
+		mEpochs.synchronize();
+
+		// old version is unreachable now, bring it up to date
+		for( const TreeWrite< T >& entry : mWrites )
+		{
+			apply( *mTrees[ mBack ], entry );
+		}
+
+		mWrites.clear();
+	}
+
+	// the tree writes go to, for writer side queries
+	// only call it from the thread that publishes, and use it while no
+	// other thread writes or publishes
+	const TTree& getWriteTree() const
+	{
+		return( *mTrees[ mBack ] );
+	}
+
+	// epoch of the last publish()
+	uint64 getEpoch() const
+	{
+		return( mEpochs.getEpoch() );
+	}
+
+private:
+
+	concurrentOctTree( const concurrentOctTree& ) = delete;
+	concurrentOctTree& operator=( const concurrentOctTree& ) = delete;
+
+	bool write( const TreeWrite< T >& entry )
+	{
+		std::lock_guard< std::mutex > lock( mWriteMutex );
+		bool result = apply( *mTrees[ mBack ], entry );
+		if (result)
+		{
+			mWrites.push_back( entry );
+		}
+
+		return( result );
+	}
+
+	static bool apply( TTree& tree, const TreeWrite< T >& entry )
+	{
+		bool result = true;
+		switch( entry.mType )
+		{
+			case TreeWrite< T >::kAdd:
+				tree.add( entry.mItem, entry.mPos, entry.mRadius );
+				break;
+
+			case TreeWrite< T >::kRemove:
+				result = tree.remove( entry.mItem );
+				break;
+
+			case TreeWrite< T >::kUpdate:
+				result = tree.update( entry.mItem, entry.mPos, entry.mRadius );
+				break;
+
+			case TreeWrite< T >::kCombine:
+				tree.combine();
+				break;
+
+			case TreeWrite< T >::kTick:
+				tree.tick();
+				break;
+		}
+
+		return( result );
+	}
+
+	std::unique_ptr< TTree > mTrees[ 2 ];
+
+	// index of the tree writes go to, the other one is published
+	int32 mBack;
+	std::atomic< const TTree* > mPublished;
+	mutable EpochManager mEpochs;
+
+	// writes since the last publish(), not yet on the published tree
+	std::mutex mWriteMutex;
+	std::vector< TreeWrite< T > > mWrites;
+};
+
+#endif
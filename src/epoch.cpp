@@ -0,0 +1,75 @@
+//
+//  epoch.cpp
+//
+
+#include "epoch.h"
+#include "Platform.h"
+
+#include <thread>
+
+EpochManager::EpochManager()
+{
+	// 0 is kIdle
+	mEpoch = 1;
+}
+
+int32 EpochManager::addReader()
+{
+	while( true )
+	{
+		for( int32 i=0; i<kMaxReaders; ++i )
+		{
+			bool used = false;
+			if (mSlots[ i ].mUsed.compare_exchange_strong( used, true ))
+			{
+				return( i );
+			}
+		}
+
+		// all taken, wait for a removeReader()
+		std::this_thread::yield();
+	}
+}
+
+void EpochManager::removeReader( int32 slot )
+{
+	errorCheck( mSlots[ slot ].mEpoch == kIdle );
+	mSlots[ slot ].mUsed = false;
+}
+
+void EpochManager::enter( int32 slot )
+{
+	// sequentially consistent, so either synchronize() sees the pin or
+	// the reader's later loads see what was published before it
+	errorCheck( mSlots[ slot ].mEpoch == kIdle );
+	mSlots[ slot ].mEpoch = mEpoch.load();
+}
+
+void EpochManager::exit( int32 slot )
+{
+	mSlots[ slot ].mEpoch = kIdle;
+}
+
+void EpochManager::synchronize()
+{
+	uint64 epoch = ++mEpoch;
+	for( int32 i=0; i<kMaxReaders; ++i )
+	{
+		while( true )
+		{
+			uint64 pinned = mSlots[ i ].mEpoch;
+			if (pinned == kIdle
+				|| pinned >= epoch)
+			{
+				break;
+			}
+
+			std::this_thread::yield();
+		}
+	}
+}
+
+uint64 EpochManager::getEpoch() const
+{
+	return( mEpoch );
+}
@@ -0,0 +1,65 @@
+//
+//  epoch.h
+//
+
+#ifndef _EPOCH_H
+#define _EPOCH_H
+
+#include "Types.h"
+
+#include <atomic>
+
+// epoch based reclamation
+// a reader pins the current epoch while it looks at shared data. a writer
+// that unlinks data calls synchronize(), which returns once every reader
+// that could have seen the old data has unpinned. readers never wait,
+// and nothing is locked on the read side.
+class EpochManager
+{
+public:
+
+	static constexpr int32 kMaxReaders = 64;
+
+	EpochManager();
+
+	// a slot for one reader thread
+	// waits for a removeReader() if all are taken
+	int32 addReader();
+	void removeReader( int32 slot );
+
+	// pin and unpin the current epoch around a read
+	// shared pointers must be loaded after enter()
+	void enter( int32 slot );
+	void exit( int32 slot );
+
+	// starts a new epoch and waits for readers pinned in older ones
+	// data unlinked before the call is free to reuse afterwards
+	void synchronize();
+
+	uint64 getEpoch() const;
+
+private:
+
+	// one cache line per slot so readers don't share lines
+	class alignas( 64 ) Slot
+	{
+	public:
+
+		Slot()
+		{
+			mEpoch = kIdle;
+			mUsed = false;
+		}
+
+		// pinned epoch or kIdle
+		std::atomic< uint64 > mEpoch;
+		std::atomic< bool > mUsed;
+	};
+
+	static constexpr uint64 kIdle = 0;
+
+	std::atomic< uint64 > mEpoch;
+	Slot mSlots[ kMaxReaders ];
+};
+
+#endif
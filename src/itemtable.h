@@ -0,0 +1,426 @@
+//
+//  itemtable.h
+//
+
+#ifndef _ITEMTABLE_H
+#define _ITEMTABLE_H
+
+#include "Types.h"
+#include "Platform.h"
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <memory>
+
+// stable reference to an item in a tree
+// the generation changes every time a slot is reused, so a handle to
+// a removed item is detected instead of referring to its replacement
+class ItemHandle
+{
+public:
+
+	static constexpr uint32 kInvalidIndex = 0xffffffff;
+
+	ItemHandle()
+	{
+		mIndex = kInvalidIndex;
+		mGeneration = 0;
+	}
+
+	ItemHandle( uint32 index, uint32 generation )
+	{
+		mIndex = index;
+		mGeneration = generation;
+	}
+
+	bool valid() const
+	{
+		return( mIndex != kInvalidIndex );
+	}
+
+	bool operator==( const ItemHandle& right ) const
+	{
+		return( mIndex == right.mIndex
+			&& mGeneration == right.mGeneration );
+	}
+
+	bool operator!=( const ItemHandle& right ) const
+	{
+		return( (*this == right) == false );
+	}
+
+	uint32 mIndex;
+	uint32 mGeneration;
+};
+
+// dense slot table mapping handles to nodes
+// lookups are a bounds check and a generation compare
+template< typename N >
+class ItemTable
+{
+public:
+
+	ItemTable()
+	{
+		mFreeHead = ItemHandle::kInvalidIndex;
+		mSize = 0;
+	}
+
+	ItemHandle insert( N* node )
+	{
+		errorCheck( node != nullptr );
+
+		uint32 index;
+		if (mFreeHead != ItemHandle::kInvalidIndex)
+		{
+			index = mFreeHead;
+			mFreeHead = mSlots[ index ].mNextFree;
+		}
+		else
+		{
+			index = static_cast< uint32 >( mSlots.size() );
+			mSlots.push_back( Slot() );
+		}
+
+		Slot& slot = mSlots[ index ];
+		slot.mNode = node;
+		slot.mNextFree = ItemHandle::kInvalidIndex;
+		++mSize;
+
+		return( ItemHandle( index, slot.mGeneration ));
+	}
+
+	// nullptr if the handle is stale
+	N* get( const ItemHandle& handle ) const
+	{
+		if (handle.mIndex >= mSlots.size())
+		{
+			return( nullptr );
+		}
+
+		const Slot& slot = mSlots[ handle.mIndex ];
+		if (slot.mGeneration != handle.mGeneration)
+		{
+			return( nullptr );
+		}
+
+		return( slot.mNode );
+	}
+
+	bool erase( const ItemHandle& handle )
+	{
+		if (get( handle ) == nullptr)
+		{
+			return( false );
+		}
+
+		release( handle.mIndex );
+		return( true );
+	}
+
+	// invalidates every outstanding handle
+	void clear()
+	{
+		for( uint32 i=0; i<mSlots.size(); ++i )
+		{
+			if (mSlots[ i ].mNode != nullptr)
+			{
+				release( i );
+			}
+		}
+
+		errorCheck( mSize == 0 );
+	}
+
+	size_t size() const
+	{
+		return( mSize );
+	}
+
+	// number of slots, including free ones
+	// handle indexes are always below this
+	size_t capacity() const
+	{
+		return( mSlots.size() );
+	}
+
+private:
+
+	class Slot
+	{
+	public:
+
+		Slot()
+		{
+			mNode = nullptr;
+			mGeneration = 0;
+			mNextFree = ItemHandle::kInvalidIndex;
+		}
+
+		N* mNode;
+		uint32 mGeneration;
+		uint32 mNextFree;
+	};
+
+	void release( uint32 index )
+	{
+		Slot& slot = mSlots[ index ];
+		slot.mNode = nullptr;
+		slot.mGeneration++;
+		slot.mNextFree = mFreeHead;
+		mFreeHead = index;
+		--mSize;
+	}
+
+	std::vector< Slot > mSlots;
+	uint32 mFreeHead;
+	size_t mSize;
+};
+
+// per query visited marks, indexed by handle slot
+// an item listed in several leafs is marked the first time a query
+// reaches it and skipped after that. begin() starts a new query by
+// bumping the stamp, so nothing is cleared between queries.
+// one mailbox can only be used by one query at a time
+class QueryMailbox
+{
+public:
+	
+	QueryMailbox()
+	{
+		mStamp = 0;
+	}
+	
+	// numSlots = ItemTable::capacity() of the tree being queried
+	void begin( size_t numSlots )
+	{
+		if (mStamps.size() < numSlots)
+		{
+			mStamps.resize( numSlots, 0 );
+		}
+		
+		++mStamp;
+		if (mStamp == 0)
+		{
+			// wrapped, old stamps could match again
+			std::fill( mStamps.begin(), mStamps.end(), 0 );
+			mStamp = 1;
+		}
+	}
+	
+	// true the first time a slot is marked in this query
+	bool mark( uint32 index )
+	{
+		if (mStamps[ index ] == mStamp)
+		{
+			return( false );
+		}
+		
+		mStamps[ index ] = mStamp;
+		return( true );
+	}
+	
+	// true if the slot was marked in this query
+	bool isMarked( uint32 index ) const
+	{
+		return( mStamps[ index ] == mStamp );
+	}
+	
+private:
+	
+	std::vector< uint32 > mStamps;
+	uint32 mStamp;
+};
+
+// mailbox of the calling thread, for queries not given one
+// lets const queries run on one tree from several threads at once.
+// a query started from another query's callback gets the next mailbox
+// down, and mailboxes stay allocated for the thread's later queries
+template< typename TMailbox >
+class ThreadMailbox
+{
+public:
+	
+	ThreadMailbox()
+	{
+		Stack& stack = getStack();
+		if (stack.mDepth == stack.mMailboxes.size())
+		{
+			stack.mMailboxes.push_back( std::unique_ptr< TMailbox >( new TMailbox() ));
+		}
+		
+		mMailbox = stack.mMailboxes[ stack.mDepth++ ].get();
+	}
+	
+	~ThreadMailbox()
+	{
+		getStack().mDepth--;
+	}
+	
+	TMailbox& get()
+	{
+		return( *mMailbox );
+	}
+	
+private:
+	
+	ThreadMailbox( const ThreadMailbox& ) = delete;
+	ThreadMailbox& operator=( const ThreadMailbox& ) = delete;
+	
+	class Stack
+	{
+	public:
+		
+		Stack()
+		{
+			mDepth = 0;
+		}
+		
+		std::vector< std::unique_ptr< TMailbox > > mMailboxes;
+		size_t mDepth;
+	};
+	
+	static Stack& getStack()
+	{
+		static thread_local Stack stack;
+		return( stack );
+	}
+	
+	TMailbox* mMailbox;
+};
+
+// visited marks for a query of several rays at once
+// like QueryMailbox, with a bit per ray next to each stamp, so the
+// rays of a packet share one array instead of one mailbox each
+class PacketMailbox
+{
+public:
+	
+	static constexpr int32 kMaxRays = 16;
+	
+	PacketMailbox()
+	{
+		mStamp = 0;
+	}
+	
+	// numSlots = ItemTable::capacity() of the tree being queried
+	void begin( size_t numSlots )
+	{
+		if (mSlots.size() < numSlots)
+		{
+			mSlots.resize( numSlots, Slot() );
+		}
+		
+		++mStamp;
+		if (mStamp == 0)
+		{
+			// wrapped, old stamps could match again
+			std::fill( mSlots.begin(), mSlots.end(), Slot() );
+			mStamp = 1;
+		}
+	}
+	
+	// true the first time a slot is marked by ray in this query
+	bool mark( uint32 index, int32 ray )
+	{
+		Slot& slot = mSlots[ index ];
+		if (slot.mStamp != mStamp)
+		{
+			slot.mStamp = mStamp;
+			slot.mRays = 0;
+		}
+		
+		uint32 bit = 1u << ray;
+		if (slot.mRays & bit)
+		{
+			return( false );
+		}
+		
+		slot.mRays |= bit;
+		return( true );
+	}
+	
+private:
+	
+	class Slot
+	{
+	public:
+		
+		Slot()
+		{
+			mStamp = 0;
+			mRays = 0;
+		}
+		
+		uint32 mStamp;
+		uint32 mRays;
+	};
+	
+	std::vector< Slot > mSlots;
+	uint32 mStamp;
+};
+
+// hashed T to handle lookup
+// lets the T keyed add / remove / getVoxels calls work
+template< typename T >
+class HashItemIndex
+{
+public:
+
+	bool insert( const T& object, const ItemHandle& handle )
+	{
+		auto insertResult = mHandles.insert( std::make_pair( object, handle ));
+		return( insertResult.second );
+	}
+
+	// invalid handle if not found
+	ItemHandle find( const T& object ) const
+	{
+		auto iter = mHandles.find( object );
+		if (iter == mHandles.end())
+		{
+			return( ItemHandle() );
+		}
+
+		return( iter->second );
+	}
+
+	void erase( const T& object )
+	{
+		mHandles.erase( object );
+	}
+
+	void clear()
+	{
+		mHandles.clear();
+	}
+
+private:
+
+	std::unordered_map< T, ItemHandle > mHandles;
+};
+
+// no T lookup, items can only be referred to by handle
+// T doesn't need to be hashable or unique.
+// T keyed calls will not compile with this index
+template< typename T >
+class NoItemIndex
+{
+public:
+
+	bool insert( const T&, const ItemHandle& )
+	{
+		return( true );
+	}
+
+	void erase( const T& )
+	{
+	}
+
+	void clear()
+	{
+	}
+};
+
+#endif
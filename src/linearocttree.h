@@ -0,0 +1,669 @@
+//
+//  linearocttree.h
+//
+
+#ifndef _LINEAROCTTREE_H
+#define _LINEAROCTTREE_H
+
+#include "octtree.h"
+#include "morton.h"
+
+template< typename T >
+class LinearItem
+{
+public:
+
+	// items are pooled, so T must be default constructible
+	LinearItem()
+	{
+		mRadius = 0;
+	}
+
+	void reset( T item, const vec3& p, float64 radius )
+	{
+		mItem = item;
+		mPos = p;
+		mRadius = radius;
+		mLeaves.clear();
+		mHandle = ItemHandle();
+	}
+
+	T mItem;
+	ItemHandle mHandle;
+	vec3 mPos;
+	float64 mRadius;
+
+	// keys of the leafs holding this item
+	std::vector< uint64 > mLeaves;
+};
+
+// leaf of a linear octree
+// mKey is the morton code of the leaf cell shifted up to kMortonMaxLevel,
+// so leafs of every level sort in z order and a tree node's leafs
+// are one contiguous key range.
+// items are kept out of line so splits only move 16 byte leafs
+class LinearLeaf
+{
+public:
+
+	LinearLeaf()
+	{
+		mKey = 0;
+		mLevel = 0;
+		mBucket = 0;
+	}
+
+	uint64 mKey;
+	int32 mLevel;
+	uint32 mBucket;
+};
+
+// octree stored as a sorted array of leafs
+// tree nodes are not stored, they are implied by key ranges.
+// splits follow TSplitPolicy like octTree, so both backends build the
+// same voxels and answer the same queries. a split inserts 7 leafs into
+// the array, which is linear in the number of leafs, so loading is
+// slower than octTree; the array pays off in queries over a stable tree
+template< typename T, typename TItemIndex = HashItemIndex< T >,
+	typename TSplitPolicy = DistanceSplitPolicy >
+class linearOctTree
+{
+public:
+
+	using TBucket = LeafBucket< LinearItem< T > >;
+
+	// splitThreshold is passed to TSplitPolicy
+	linearOctTree( const vec3& minBounds, const vec3& maxBounds, float64 minVoxelSize, int32 splitThreshold = 2 ) :
+		mSplitPolicy( minVoxelSize, splitThreshold )
+	{
+		mBounds.add( minBounds );
+		mBounds.add( maxBounds );
+		clear();
+	}
+
+	void clear()
+	{
+		mLeaves.clear();
+		mBuckets.clear();
+		mFreeBuckets.clear();
+		
+		LinearLeaf root;
+		root.mBucket = allocBucket();
+		mLeaves.push_back( root );
+		
+		mItemPool.reset();
+		mHandles.clear();
+		mIndex.clear();
+	}
+
+	ItemHandle add( T object, const vec3& p, float64 radius )
+	{
+		Box3 box( p, radius );
+
+		// must be in bounds of root
+		errorCheck( mBounds.contains( box ) );
+
+		LinearItem<T>* item = mItemPool.alloc();
+		item->reset( object, p, radius );
+		ItemHandle handle = mHandles.insert( item );
+		item->mHandle = handle;
+
+		// must be unique
+		bool inserted = mIndex.insert( object, handle );
+		errorCheck( inserted );
+
+		attach( item );
+		return( handle );
+	}
+
+	bool remove( T object )
+	{
+		ItemHandle handle = mIndex.find( object );
+		errorCheck( handle.valid() );
+
+		bool result = remove( handle );
+		errorCheck( result );
+
+		return( result );
+	}
+
+	bool remove( ItemHandle handle )
+	{
+		LinearItem<T>* item = mHandles.get( handle );
+		if (item == nullptr)
+		{
+			return( false );
+		}
+
+		detach( item );
+
+		mIndex.erase( item->mItem );
+		mHandles.erase( handle );
+		mItemPool.free( item );
+
+		return( true );
+	}
+
+	bool update( ItemHandle handle, const vec3& p, float64 radius )
+	{
+		LinearItem<T>* item = mHandles.get( handle );
+		if (item == nullptr)
+		{
+			return( false );
+		}
+
+		errorCheck( mBounds.contains( Box3( p, radius )));
+
+		detach( item );
+		item->mPos = p;
+		item->mRadius = radius;
+		attach( item );
+
+		return( true );
+	}
+
+	void getItems( const vec3& p, float64 radius, std::set< T >& out ) const
+	{
+		Box3 bounds( p, radius );
+		vec3 boundsMin = bounds.getMin();
+		vec3 boundsMax = bounds.getMax();
+
+		auto test = [&]( const Box3& nodeBounds )
+		{
+			return( nodeBounds.intersects( bounds ));
+		};
+
+		auto visit = [&]( size_t index, const Box3& )
+		{
+			const TBucket& items = mBuckets[ mLeaves[ index ].mBucket ];
+			for( size_t i=0; i<items.size(); ++i )
+			{
+				if (items.intersects( i, boundsMin, boundsMax ))
+				{
+					out.insert( items.mItems[ i ]->mItem );
+				}
+			}
+		};
+
+		traverseBox( bounds, test, visit );
+	}
+
+	// get items from a beam (line with radius)
+	void getItems( const vec3& p1, const vec3& p2, float64 radius, std::set< T >& out ) const
+	{
+		vec3 v = p2 - p1;
+
+		auto test = [&]( const Box3& nodeBounds )
+		{
+			return( nodeBounds.getRayEntry( p1, p2, radius ) >= 0 );
+		};
+
+		auto visit = [&]( size_t index, const Box3& )
+		{
+			const TBucket& items = mBuckets[ mLeaves[ index ].mBucket ];
+			for( size_t i=0; i<items.size(); ++i )
+			{
+				if (getCollision( p1, v, items.getPos( i ), radius + items.mRadius[ i ] ) >= 0)
+				{
+					out.insert( items.mItems[ i ]->mItem );
+				}
+			}
+		};
+
+		Box3 beamBounds( p1, p2 );
+		beamBounds.addSphere( p1, radius );
+		beamBounds.addSphere( p2, radius );
+		traverseBox( beamBounds, test, visit );
+	}
+
+	using TBounds = std::vector< Box3 >;
+	bool getVoxels( T object, TBounds& boundsOut ) const
+	{
+		return( getVoxels( mIndex.find( object ), boundsOut ));
+	}
+
+	bool getVoxels( ItemHandle handle, TBounds& boundsOut ) const
+	{
+		LinearItem<T>* item = mHandles.get( handle );
+		if (item == nullptr)
+		{
+			return( false );
+		}
+
+		for( uint64 key : item->mLeaves )
+		{
+			const LinearLeaf& leaf = mLeaves[ findLeaf( key ) ];
+			boundsOut.push_back( getLeafBounds( leaf.mKey, leaf.mLevel ));
+		}
+
+		return( true );
+	}
+
+	void getVoxels( const Box3& bounds, TBounds& out ) const
+	{
+		auto test = [&]( const Box3& nodeBounds )
+		{
+			return( nodeBounds.intersects( bounds ));
+		};
+
+		auto visit = [&]( size_t, const Box3& leafBounds )
+		{
+			out.push_back( leafBounds );
+		};
+
+		traverseBox( bounds, test, visit );
+	}
+
+	ItemHandle getHandle( T object ) const
+	{
+		return( mIndex.find( object ));
+	}
+
+	bool contains( ItemHandle handle ) const
+	{
+		return( mHandles.get( handle ) != nullptr );
+	}
+
+	Box3 getBounds() const
+	{
+		return( mBounds );
+	}
+
+	size_t getNumItems() const
+	{
+		return( mHandles.size() );
+	}
+
+	size_t getNumLeaves() const
+	{
+		return( mLeaves.size() );
+	}
+
+	// voxels including the implied tree nodes, same count as octTree
+	// every split turns 1 leaf into 8
+	size_t getNumVoxels() const
+	{
+		return( 1 + (((mLeaves.size() - 1) / 7) * 8) );
+	}
+
+private:
+
+	static int32 getShift( int32 level )
+	{
+		return( 3 * (kMortonMaxLevel - level) );
+	}
+
+	// key range covered by a node at level
+	static uint64 getSpan( int32 level )
+	{
+		return( static_cast< uint64 >( 1 ) << getShift( level ));
+	}
+
+	// first leaf in [first, last) with a key >= key
+	size_t lowerBound( size_t first, size_t last, uint64 key ) const
+	{
+		auto iter = std::lower_bound( mLeaves.begin() + first, mLeaves.begin() + last, key,
+			[]( const LinearLeaf& leaf, uint64 k )
+			{
+				return( leaf.mKey < k );
+			} );
+
+		return( iter - mLeaves.begin() );
+	}
+
+	size_t findLeaf( uint64 key ) const
+	{
+		size_t index = lowerBound( 0, mLeaves.size(), key );
+		errorCheck( index < mLeaves.size() && mLeaves[ index ].mKey == key );
+		return( index );
+	}
+
+	// walk down from the root with split8 so bounds match octTree exactly
+	Box3 getLeafBounds( uint64 key, int32 level ) const
+	{
+		Box3 bounds = mBounds;
+		Box3 childBounds[ 8 ];
+		for( int32 i=1; i<=level; ++i )
+		{
+			int32 child = static_cast< int32 >( (key >> getShift( i )) & 7 );
+			split8( bounds, childBounds );
+			bounds = childBounds[ child ];
+		}
+
+		return( bounds );
+	}
+
+	// smallest implied node whose interior holds box, from the morton
+	// codes of the box corners on the finest grid over mBounds. the
+	// root if box reaches outside it
+	void getEnclosingNode( const Box3& box, uint64& keyOut, int32& levelOut, Box3& boundsOut ) const
+	{
+		uint64 low = mortonEncode( mBounds, box.getMin(), kMortonMaxLevel );
+		uint64 high = mortonEncode( mBounds, box.getMax(), kMortonMaxLevel );
+
+		// common prefix of the corners, no deeper than the leaf holding low
+		int32 level = mLeaves[ lowerBound( 0, mLeaves.size(), low + 1 ) - 1 ].mLevel;
+		for( int32 i=1; i<=level; ++i )
+		{
+			if ((low >> getShift( i )) != (high >> getShift( i )))
+			{
+				level = i - 1;
+				break;
+			}
+		}
+
+		// grid cells and split8() bounds can round differently,
+		// step up until the box is inside
+		while( true )
+		{
+			keyOut = low & ~(getSpan( level ) - 1);
+			boundsOut = getLeafBounds( keyOut, level );
+			if (level == 0
+				|| boundsOut.containsInterior( box ))
+			{
+				break;
+			}
+
+			--level;
+		}
+
+		levelOut = level;
+	}
+
+	// traverse() from the node enclosing box instead of the root
+	template< typename TTest, typename TVisit >
+	void traverseBox( const Box3& box, TTest& test, TVisit& visit ) const
+	{
+		uint64 key;
+		int32 level;
+		Box3 bounds;
+		getEnclosingNode( box, key, level, bounds );
+		if (level == 0)
+		{
+			traverse( 0, 0, mBounds, 0, mLeaves.size(), test, visit );
+			return;
+		}
+
+		size_t first = lowerBound( 0, mLeaves.size(), key );
+		size_t last = lowerBound( first, mLeaves.size(), key + getSpan( level ));
+		traverse( key, level, bounds, first, last, test, visit );
+	}
+
+	// walk the implied node (key, level) whose leafs are [first, last)
+	// test( bounds ) culls nodes, visit( index, bounds ) is called per leaf
+	template< typename TTest, typename TVisit >
+	void traverse( uint64 key, int32 level, const Box3& bounds, size_t first, size_t last,
+		TTest& test, TVisit& visit ) const
+	{
+		if (test( bounds ))
+		{
+			traverseNode( key, level, bounds, first, last, test, visit );
+		}
+	}
+
+	// node has already passed the test
+	// child ranges are only searched for children that pass
+	template< typename TTest, typename TVisit >
+	void traverseNode( uint64 key, int32 level, const Box3& bounds, size_t first, size_t last,
+		TTest& test, TVisit& visit ) const
+	{
+		const LinearLeaf& leaf = mLeaves[ first ];
+		if (leaf.mLevel == level)
+		{
+			// node is a leaf
+			errorCheck( leaf.mKey == key && last - first == 1 );
+			visit( first, bounds );
+			return;
+		}
+
+		Box3 childBounds[ 8 ];
+		split8( bounds, childBounds );
+
+		size_t cursor = first;
+		for( int32 i=0; i<8; ++i )
+		{
+			if (test( childBounds[ i ] ) == false)
+			{
+				continue;
+			}
+
+			uint64 childKey = key | (static_cast< uint64 >( i ) << getShift( level + 1 ));
+			size_t childFirst = lowerBound( cursor, last, childKey );
+			size_t childLast = lowerBound( childFirst, last, childKey + getSpan( level + 1 ));
+			traverseNode( childKey, level + 1, childBounds[ i ], childFirst, childLast, test, visit );
+			cursor = childLast;
+		}
+	}
+
+	// add to all intersecting leafs and split them as needed
+	void attach( LinearItem<T>* item )
+	{
+		Box3 box( item->mPos, item->mRadius );
+
+		auto test = [&]( const Box3& nodeBounds )
+		{
+			return( nodeBounds.intersects( box ));
+		};
+
+		auto visit = [&]( size_t index, const Box3& )
+		{
+			LinearLeaf& leaf = mLeaves[ index ];
+			mBuckets[ leaf.mBucket ].add( item );
+			item->mLeaves.push_back( leaf.mKey );
+		};
+
+		traverseBox( box, test, visit );
+
+		// must be in at least one voxel
+		errorCheck( item->mLeaves.size() > 0 );
+
+		// divide changes the item's leafs
+		std::vector< uint64 > keys( item->mLeaves );
+		for( uint64 key : keys )
+		{
+			divide( key );
+		}
+	}
+
+	// remove from all leafs and combine what can be combined
+	void detach( LinearItem<T>* item )
+	{
+		std::vector< uint64 > keys;
+		keys.swap( item->mLeaves );
+
+		for( uint64 key : keys )
+		{
+			LinearLeaf& leaf = mLeaves[ findLeaf( key ) ];
+			bool removed = mBuckets[ leaf.mBucket ].remove( item );
+			errorCheck( removed );
+		}
+
+		for( uint64 key : keys )
+		{
+			combine( key, leafLevel( key ));
+		}
+	}
+
+	// level of a key that was a leaf before detach() started
+	// a leaf never has a deeper leaf with the same key
+	int32 leafLevel( uint64 key ) const
+	{
+		size_t index = lowerBound( 0, mLeaves.size(), key );
+		if (index < mLeaves.size()
+			&& mLeaves[ index ].mKey == key)
+		{
+			return( mLeaves[ index ].mLevel );
+		}
+
+		// already combined into a parent
+		return( 0 );
+	}
+
+	void divide( uint64 key )
+	{
+		size_t index = findLeaf( key );
+		int32 level = mLeaves[ index ].mLevel;
+		if (level >= kMortonMaxLevel)
+		{
+			return;
+		}
+
+		Box3 bounds = getLeafBounds( key, level );
+		float64 maxAlignedDist;
+		uint32 parentBucket = mLeaves[ index ].mBucket;
+		if (mSplitPolicy.shouldSplit( mBuckets[ parentBucket ], bounds.getSize().mX, maxAlignedDist ) == false)
+		{
+			return;
+		}
+
+		Box3 childBounds[ 8 ];
+		split8( bounds, childBounds );
+
+		// the 8 children take the place of the leaf
+		mLeaves.insert( mLeaves.begin() + index + 1, 7, LinearLeaf() );
+
+		uint64 childKeys[ 8 ];
+		for( int32 i=0; i<8; ++i )
+		{
+			childKeys[ i ] = key | (static_cast< uint64 >( i ) << getShift( level + 1 ));
+			LinearLeaf& child = mLeaves[ index + i ];
+			child.mKey = childKeys[ i ];
+			child.mLevel = level + 1;
+			child.mBucket = allocBucket();
+		}
+
+		// migrate items to children
+		for( LinearItem<T>* item : mBuckets[ parentBucket ] )
+		{
+			auto iter = std::find( item->mLeaves.begin(), item->mLeaves.end(), key );
+			errorCheck( iter != item->mLeaves.end() );
+			item->mLeaves.erase( iter );
+
+			Box3 box( item->mPos, item->mRadius );
+			for( int32 i=0; i<8; ++i )
+			{
+				if (childBounds[ i ].intersects( box ))
+				{
+					mBuckets[ mLeaves[ index + i ].mBucket ].add( item );
+					item->mLeaves.push_back( childKeys[ i ] );
+				}
+			}
+		}
+
+		freeBucket( parentBucket );
+
+		// look to subdivide further
+		for( int32 i=0; i<8; ++i )
+		{
+			divide( childKeys[ i ] );
+		}
+	}
+
+	// trivial combines, same as Voxel::remove()
+	// parents with only 0 or 1 items left become a leaf again
+	void combine( uint64 key, int32 level )
+	{
+		for( ; level > 0; --level )
+		{
+			int32 parentLevel = level - 1;
+			uint64 parentKey = key & ~(getSpan( parentLevel ) - 1);
+			size_t first = lowerBound( 0, mLeaves.size(), parentKey );
+			size_t last = lowerBound( first, mLeaves.size(), parentKey + getSpan( parentLevel ));
+
+			// only combine if all 8 children are leafs
+			if (last - first != 8)
+			{
+				return;
+			}
+
+			LinearItem<T>* item = nullptr;
+			for( size_t i=first; i<last; ++i )
+			{
+				for( LinearItem<T>* item2 : mBuckets[ mLeaves[ i ].mBucket ] )
+				{
+					if (item == nullptr)
+					{
+						item = item2;
+					}
+					else if (item != item2)
+					{
+						// 2 or more items, keep children
+						return;
+					}
+				}
+			}
+
+			if (item != nullptr)
+			{
+				for( size_t i=first; i<last; ++i )
+				{
+					auto iter = std::find( item->mLeaves.begin(), item->mLeaves.end(), mLeaves[ i ].mKey );
+					if (iter != item->mLeaves.end())
+					{
+						item->mLeaves.erase( iter );
+					}
+				}
+
+				item->mLeaves.push_back( parentKey );
+			}
+
+			for( size_t i=first + 1; i<last; ++i )
+			{
+				freeBucket( mLeaves[ i ].mBucket );
+			}
+
+			// first child's bucket is reused
+			LinearLeaf& parent = mLeaves[ first ];
+			parent.mKey = parentKey;
+			parent.mLevel = parentLevel;
+			TBucket& bucket = mBuckets[ parent.mBucket ];
+			bucket.clear();
+			if (item != nullptr)
+			{
+				bucket.add( item );
+			}
+
+			mLeaves.erase( mLeaves.begin() + first + 1, mLeaves.begin() + last );
+			key = parentKey;
+		}
+	}
+
+	uint32 allocBucket()
+	{
+		uint32 index;
+		if (mFreeBuckets.size() > 0)
+		{
+			index = mFreeBuckets.back();
+			mFreeBuckets.pop_back();
+			mBuckets[ index ].clear();
+		}
+		else
+		{
+			index = static_cast< uint32 >( mBuckets.size() );
+			mBuckets.push_back( TBucket() );
+		}
+
+		return( index );
+	}
+
+	void freeBucket( uint32 index )
+	{
+		mFreeBuckets.push_back( index );
+	}
+
+	Box3 mBounds;
+	TSplitPolicy mSplitPolicy;
+
+	// sorted by key
+	std::vector< LinearLeaf > mLeaves;
+
+	// leaf items, indexed by LinearLeaf::mBucket
+	std::vector< TBucket > mBuckets;
+	std::vector< uint32 > mFreeBuckets;
+
+	NodePool< LinearItem< T > > mItemPool;
+	ItemTable< LinearItem< T > > mHandles;
+	TItemIndex mIndex;
+};
+
+#endif
@@ -0,0 +1,654 @@
+//
+//  looseocttree.h
+//
+
+#ifndef _LOOSEOCTTREE_H
+#define _LOOSEOCTTREE_H
+
+#include "octtree.h"
+
+template< typename T > class LooseNode;
+
+template< typename T >
+class LooseItem
+{
+public:
+
+	// items are pooled, so T must be default constructible
+	LooseItem()
+	{
+		mRadius = 0;
+		mNode = nullptr;
+	}
+
+	void reset( T item, const vec3& p, float64 radius )
+	{
+		mItem = item;
+		mPos = p;
+		mRadius = radius;
+		mNode = nullptr;
+		mHandle = ItemHandle();
+	}
+
+	T mItem;
+	ItemHandle mHandle;
+	vec3 mPos;
+	float64 mRadius;
+
+	// the one node holding this item
+	LooseNode< T >* mNode;
+};
+
+// children of a loose node are allocated together
+template< typename T >
+class LooseBlock
+{
+public:
+
+	LooseNode< T > mNodes[ 8 ];
+};
+
+// node of a loose octree
+// mBounds is the cell from split8, mLooseBounds the same cell grown by
+// the looseness factor around its center. items whose center is in the
+// cell and whose box fits in the loose bounds can be held by the node,
+// internal nodes included
+template< typename T >
+class LooseNode
+{
+public:
+
+	LooseNode()
+	{
+		mParent = nullptr;
+		mChildren = nullptr;
+		mNumItems = 0;
+	}
+
+	void reset( LooseNode* parent, const Box3& bounds, float64 looseness )
+	{
+		mParent = parent;
+		mBounds = bounds;
+		mLooseBounds = Box3( bounds.getCenter(), bounds.getSize().mX * looseness / 2 );
+		mItems.clear();
+		mChildren = nullptr;
+		mNumItems = 0;
+	}
+
+	bool isLeaf() const
+	{
+		return( mChildren == nullptr );
+	}
+
+	float64 getSize() const
+	{
+		return( mBounds.getSize().mX );
+	}
+
+	// child whose cell holds p
+	// child index is x * 4 + y * 2 + z, same as split8
+	LooseNode* getChild( const vec3& p ) const
+	{
+		vec3 center = mBounds.getCenter();
+		int32 index = (p.mX >= center.mX ? 4 : 0)
+			+ (p.mY >= center.mY ? 2 : 0)
+			+ (p.mZ >= center.mZ ? 1 : 0);
+
+		return( &mChildren->mNodes[ index ] );
+	}
+
+	template< typename F >
+	bool forEachItem( const Box3& bounds, const vec3& boundsMin, const vec3& boundsMax, F& f ) const
+	{
+		if (mNumItems == 0
+			|| mLooseBounds.intersects( bounds ) == false)
+		{
+			return( true );
+		}
+
+		if (mItems.forEachHit( boundsMin, boundsMax, [&]( size_t i )
+		{
+			return( f( mItems.mItems[ i ]->mItem ));
+		} ) == false)
+		{
+			return( false );
+		}
+
+		if (isLeaf() == false)
+		{
+			for( const LooseNode& child : mChildren->mNodes )
+			{
+				if (child.forEachItem( bounds, boundsMin, boundsMax, f ) == false)
+				{
+					return( false );
+				}
+			}
+		}
+
+		return( true );
+	}
+
+	// beam version, v = p2 - p1
+	template< typename F >
+	bool forEachItem( const vec3& p1, const vec3& p2, const vec3& v, float64 radius, F& f ) const
+	{
+		if (mNumItems == 0
+			|| mLooseBounds.getRayEntry( p1, p2, radius ) < 0)
+		{
+			return( true );
+		}
+
+		if (mItems.forEachHit( p1, v, radius, [&]( size_t i, float64 )
+		{
+			return( f( mItems.mItems[ i ]->mItem ));
+		} ) == false)
+		{
+			return( false );
+		}
+
+		if (isLeaf() == false)
+		{
+			for( const LooseNode& child : mChildren->mNodes )
+			{
+				if (child.forEachItem( p1, p2, v, radius, f ) == false)
+				{
+					return( false );
+				}
+			}
+		}
+
+		return( true );
+	}
+
+	// overlapping pairs of items in this node and below
+	template< typename F >
+	bool forEachOverlappingPair( F& f ) const
+	{
+		if (mNumItems < 2)
+		{
+			return( true );
+		}
+		
+		for( size_t i=0; i<mItems.size(); ++i )
+		{
+			for( size_t j=i+1; j<mItems.size(); ++j )
+			{
+				if (spheresOverlap( mItems.getPos( i ), mItems.mRadius[ i ], mItems.getPos( j ), mItems.mRadius[ j ] )
+					&& f( mItems.mItems[ i ]->mItem, mItems.mItems[ j ]->mItem ) == false)
+				{
+					return( false );
+				}
+			}
+		}
+		
+		if (isLeaf())
+		{
+			return( true );
+		}
+		
+		// items straddling the children against the items below
+		for( const LooseItem<T>* item : mItems )
+		{
+			for( const LooseNode& child : mChildren->mNodes )
+			{
+				if (child.forEachOverlap( item, f ) == false)
+				{
+					return( false );
+				}
+			}
+		}
+		
+		for( int32 c=0; c<8; ++c )
+		{
+			const LooseNode& child = mChildren->mNodes[ c ];
+			if (child.forEachOverlappingPair( f ) == false)
+			{
+				return( false );
+			}
+			
+			// loose bounds of neighbours overlap
+			for( int32 d=c+1; d<8; ++d )
+			{
+				if (forEachOverlappingPair( child, mChildren->mNodes[ d ], f ) == false)
+				{
+					return( false );
+				}
+			}
+		}
+		
+		return( true );
+	}
+	
+	// pairs with one item in a or below and the other in b or below
+	// a and b swap at every step, so both sides descend in turn
+	template< typename F >
+	static bool forEachOverlappingPair( const LooseNode& a, const LooseNode& b, F& f )
+	{
+		if (a.mNumItems == 0
+			|| b.mNumItems == 0
+			|| a.mLooseBounds.intersects( b.mLooseBounds ) == false)
+		{
+			return( true );
+		}
+		
+		for( const LooseItem<T>* item : a.mItems )
+		{
+			if (b.forEachOverlap( item, f ) == false)
+			{
+				return( false );
+			}
+		}
+		
+		if (a.isLeaf() == false)
+		{
+			for( const LooseNode& child : a.mChildren->mNodes )
+			{
+				if (forEachOverlappingPair( b, child, f ) == false)
+				{
+					return( false );
+				}
+			}
+		}
+		
+		return( true );
+	}
+	
+	// f( item, other ) for items in this node and below overlapping item
+	template< typename F >
+	bool forEachOverlap( const LooseItem<T>* item, F& f ) const
+	{
+		if (mNumItems == 0
+			|| mLooseBounds.intersects( Box3( item->mPos, item->mRadius )) == false)
+		{
+			return( true );
+		}
+		
+		for( size_t i=0; i<mItems.size(); ++i )
+		{
+			if (spheresOverlap( item->mPos, item->mRadius, mItems.getPos( i ), mItems.mRadius[ i ] )
+				&& f( item->mItem, mItems.mItems[ i ]->mItem ) == false)
+			{
+				return( false );
+			}
+		}
+		
+		if (isLeaf() == false)
+		{
+			for( const LooseNode& child : mChildren->mNodes )
+			{
+				if (child.forEachOverlap( item, f ) == false)
+				{
+					return( false );
+				}
+			}
+		}
+		
+		return( true );
+	}
+	
+	Box3 mBounds;
+	Box3 mLooseBounds;
+
+	// items held by this node, not its children
+	LeafBucket< LooseItem< T > > mItems;
+	LooseNode* mParent;
+
+	// nullptr for a leaf
+	LooseBlock< T >* mChildren;
+
+	// items in this node and below
+	int32 mNumItems;
+};
+
+// loose octree
+// every item is in exactly one node, picked by its center and radius,
+// so there is no per voxel item list and every query visits an item once.
+// nodes are looseness times the size of their cell, so an item stays in
+// a deep node even when it crosses the cell's split planes.
+// a node splits when it holds more than splitThreshold items, and
+// empty subtrees are released as items leave
+template< typename T, typename TItemIndex = HashItemIndex< T > >
+class looseOctTree
+{
+public:
+
+	// looseness must be > 1, 2 is usual
+	looseOctTree( const vec3& minBounds, const vec3& maxBounds, float64 minVoxelSize,
+		float64 looseness = 2, int32 splitThreshold = 8 )
+	{
+		errorCheck( looseness > 1 );
+		errorCheck( splitThreshold >= 1 );
+
+		mBounds.add( minBounds );
+		mBounds.add( maxBounds );
+		mMinVoxelSize = minVoxelSize;
+		mLooseness = looseness;
+		mSplitThreshold = splitThreshold;
+		clear();
+	}
+
+	void clear()
+	{
+		mBlocks.reset();
+		mItemPool.reset();
+		mRoot.reset( nullptr, mBounds, mLooseness );
+		mHandles.clear();
+		mIndex.clear();
+	}
+
+	ItemHandle add( T object, const vec3& p, float64 radius )
+	{
+		// must be in bounds of root
+		errorCheck( mBounds.contains( Box3( p, radius )));
+
+		LooseItem<T>* item = mItemPool.alloc();
+		item->reset( object, p, radius );
+		ItemHandle handle = mHandles.insert( item );
+		item->mHandle = handle;
+
+		// must be unique
+		bool inserted = mIndex.insert( object, handle );
+		errorCheck( inserted );
+
+		attach( item );
+		return( handle );
+	}
+
+	bool remove( T object )
+	{
+		ItemHandle handle = mIndex.find( object );
+		errorCheck( handle.valid() );
+
+		bool result = remove( handle );
+		errorCheck( result );
+
+		return( result );
+	}
+
+	bool remove( ItemHandle handle )
+	{
+		LooseItem<T>* item = mHandles.get( handle );
+		if (item == nullptr)
+		{
+			return( false );
+		}
+
+		detach( item );
+
+		mIndex.erase( item->mItem );
+		mHandles.erase( handle );
+		mItemPool.free( item );
+
+		return( true );
+	}
+
+	// an item that still belongs to its node only gets its new position.
+	// otherwise it is taken out and put back in, O(depth)
+	bool update( ItemHandle handle, const vec3& p, float64 radius )
+	{
+		LooseItem<T>* item = mHandles.get( handle );
+		if (item == nullptr)
+		{
+			return( false );
+		}
+
+		errorCheck( mBounds.contains( Box3( p, radius )));
+
+		LooseNode<T>* node = item->mNode;
+		item->mPos = p;
+		item->mRadius = radius;
+		if (node->mBounds.contains( Box3( p, 0 ))
+			&& fits( node, radius )
+			&& (node->isLeaf() || fits( node->getChild( p ), radius ) == false))
+		{
+			bool updated = node->mItems.update( item );
+			errorCheck( updated );
+		}
+		else
+		{
+			detach( item );
+			attach( item );
+		}
+
+		return( true );
+	}
+
+	bool update( T object, const vec3& p, float64 radius )
+	{
+		return( update( mIndex.find( object ), p, radius ));
+	}
+
+	void getItems( const vec3& p, float64 radius, std::set< T >& out ) const
+	{
+		forEachItem( Box3( p, radius ), [&out]( const T& item )
+		{
+			out.insert( item );
+			return( true );
+		} );
+	}
+
+	void getItems( const vec3& p, float64 radius, std::vector< T >& out ) const
+	{
+		forEachItem( Box3( p, radius ), [&out]( const T& item )
+		{
+			out.push_back( item );
+			return( true );
+		} );
+	}
+
+	// get items from a beam (line with radius)
+	void getItems( const vec3& p1, const vec3& p2, float64 radius, std::set< T >& out ) const
+	{
+		forEachItem( p1, p2, radius, [&out]( const T& item )
+		{
+			out.insert( item );
+			return( true );
+		} );
+	}
+
+	void getItems( const vec3& p1, const vec3& p2, float64 radius, std::vector< T >& out ) const
+	{
+		forEachItem( p1, p2, radius, [&out]( const T& item )
+		{
+			out.push_back( item );
+			return( true );
+		} );
+	}
+
+	// calls f( item ) once for every item intersecting bounds
+	// items are only in one node, so no mailbox is needed and
+	// concurrent queries are safe. f returns false to stop early
+	template< typename F >
+	bool forEachItem( const Box3& bounds, F&& f ) const
+	{
+		return( mRoot.forEachItem( bounds, bounds.getMin(), bounds.getMax(), f ));
+	}
+
+	template< typename F >
+	bool forEachItem( const vec3& p1, const vec3& p2, float64 radius, F&& f ) const
+	{
+		return( mRoot.forEachItem( p1, p2, p2 - p1, radius, f ));
+	}
+
+	// calls f( a, b ) once for every pair of items whose spheres overlap
+	// items are paired within a node, with the straddling items of the
+	// nodes above and with neighbouring subtrees whose loose bounds touch.
+	// f returns false to stop early
+	template< typename F >
+	bool forEachOverlappingPair( F&& f ) const
+	{
+		return( mRoot.forEachOverlappingPair( f ));
+	}
+	
+	// loose bounds of the node holding an item
+	bool getVoxel( ItemHandle handle, Box3& boundsOut ) const
+	{
+		LooseItem<T>* item = mHandles.get( handle );
+		if (item == nullptr)
+		{
+			return( false );
+		}
+
+		boundsOut = item->mNode->mLooseBounds;
+		return( true );
+	}
+
+	ItemHandle getHandle( T object ) const
+	{
+		return( mIndex.find( object ));
+	}
+
+	bool contains( ItemHandle handle ) const
+	{
+		return( mHandles.get( handle ) != nullptr );
+	}
+
+	Box3 getBounds() const
+	{
+		return( mBounds );
+	}
+
+	size_t getNumItems() const
+	{
+		return( mHandles.size() );
+	}
+
+	size_t getNumVoxels() const
+	{
+		return( 1 + mBlocks.getNumAllocated() * 8 );
+	}
+
+private:
+
+	// an item of radius can be held by a node
+	// its box is inside the loose bounds when its center is in the cell
+	bool fits( const LooseNode<T>* node, float64 radius ) const
+	{
+		return( radius <= (mLooseness - 1) * node->getSize() / 2 );
+	}
+
+	// child nodes would not be below the minimum size
+	bool canSplit( const LooseNode<T>* node ) const
+	{
+		return( node->getSize() / 2 >= mMinVoxelSize );
+	}
+
+	// put an item in the deepest node it fits, splitting full leafs
+	void attach( LooseItem<T>* item )
+	{
+		LooseNode<T>* node = &mRoot;
+		for( ;; )
+		{
+			node->mNumItems++;
+			if (node->isLeaf()
+				&& static_cast< int32 >( node->mItems.size() ) >= mSplitThreshold
+				&& canSplit( node ))
+			{
+				divide( node );
+			}
+
+			if (node->isLeaf())
+			{
+				break;
+			}
+
+			LooseNode<T>* child = node->getChild( item->mPos );
+			if (fits( child, item->mRadius ) == false)
+			{
+				break;
+			}
+
+			node = child;
+		}
+
+		node->mItems.add( item );
+		item->mNode = node;
+	}
+
+	void detach( LooseItem<T>* item )
+	{
+		LooseNode<T>* node = item->mNode;
+		bool removed = node->mItems.remove( item );
+		errorCheck( removed );
+		item->mNode = nullptr;
+
+		// release the highest subtree left empty
+		LooseNode<T>* emptyNode = nullptr;
+		for( ; node != nullptr; node = node->mParent )
+		{
+			errorCheck( node->mNumItems > 0 );
+			node->mNumItems--;
+			if (node->isLeaf() == false
+				&& node->mNumItems == static_cast< int32 >( node->mItems.size() ))
+			{
+				emptyNode = node;
+			}
+		}
+
+		if (emptyNode != nullptr)
+		{
+			freeChildren( emptyNode );
+		}
+	}
+
+	// give a leaf children and move down the items that fit in them
+	void divide( LooseNode<T>* node )
+	{
+		errorCheck( node->isLeaf() );
+
+		Box3 childBounds[ 8 ];
+		split8( node->mBounds, childBounds );
+
+		node->mChildren = mBlocks.alloc();
+		for( int32 i=0; i<8; ++i )
+		{
+			node->mChildren->mNodes[ i ].reset( node, childBounds[ i ], mLooseness );
+		}
+
+		for( size_t i=0; i<node->mItems.size(); )
+		{
+			LooseItem<T>* item = node->mItems.mItems[ i ];
+			LooseNode<T>* child = node->getChild( item->mPos );
+			if (fits( child, item->mRadius ))
+			{
+				// remove() moves the last item into i
+				node->mItems.remove( item );
+				child->mItems.add( item );
+				child->mNumItems++;
+				item->mNode = child;
+			}
+			else
+			{
+				++i;
+			}
+		}
+	}
+
+	void freeChildren( LooseNode<T>* node )
+	{
+		for( LooseNode<T>& child : node->mChildren->mNodes )
+		{
+			errorCheck( child.mNumItems == 0 );
+			if (child.isLeaf() == false)
+			{
+				freeChildren( &child );
+			}
+		}
+
+		mBlocks.free( node->mChildren );
+		node->mChildren = nullptr;
+	}
+
+	Box3 mBounds;
+	float64 mMinVoxelSize;
+	float64 mLooseness;
+	int32 mSplitThreshold;
+
+	LooseNode< T > mRoot;
+	NodePool< LooseBlock< T >, 64 > mBlocks;
+	NodePool< LooseItem< T > > mItemPool;
+	ItemTable< LooseItem< T > > mHandles;
+	TItemIndex mIndex;
+};
+
+#endif
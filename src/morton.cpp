@@ -0,0 +1,42 @@
+//
+//  morton.cpp
+//
+
+#include "morton.h"
+#include "Platform.h"
+
+// spread the low 21 bits so there are 2 zero bits between each
+static uint64 spreadBits( uint32 v )
+{
+	uint64 x = v & 0x1fffff;
+	x = (x | (x << 32)) & 0x001f00000000ffffULL;
+	x = (x | (x << 16)) & 0x001f0000ff0000ffULL;
+	x = (x | (x << 8)) & 0x100f00f00f00f00fULL;
+	x = (x | (x << 4)) & 0x10c30c30c30c30c3ULL;
+	x = (x | (x << 2)) & 0x1249249249249249ULL;
+	return( x );
+}
+
+uint64 mortonEncode( uint32 x, uint32 y, uint32 z )
+{
+	return( (spreadBits( x ) << 2) | (spreadBits( y ) << 1) | spreadBits( z ));
+}
+
+uint64 mortonEncode( const Box3& bounds, const vec3& p, int32 level )
+{
+	errorCheck( level >= 0 && level <= kMortonMaxLevel );
+	
+	vec3 minBounds = bounds.getMin();
+	vec3 size = bounds.getSize();
+	float64 cells = static_cast< float64 >( 1u << level );
+	
+	uint32 coords[ 3 ];
+	for( int32 i=0; i<3; ++i )
+	{
+		float64 t = (p[ i ] - minBounds[ i ]) / size[ i ];
+		float64 cell = cap( t * cells, 0, cells - 1 );
+		coords[ i ] = static_cast< uint32 >( cell );
+	}
+	
+	return( mortonEncode( coords[ 0 ], coords[ 1 ], coords[ 2 ] ));
+}
@@ -0,0 +1,23 @@
+//
+//  morton.h
+//
+
+#ifndef _MORTON_H
+#define _MORTON_H
+
+#include "Types.h"
+#include "vec3.h"
+#include "box3.h"
+
+// max levels that fit a 64 bit code (3 bits per level)
+constexpr int32 kMortonMaxLevel = 21;
+
+// interleave the low 21 bits of x, y, z
+// x is the highest bit of each triple, matching the child order of split8
+uint64 mortonEncode( uint32 x, uint32 y, uint32 z );
+
+// code of the cell containing p on a 2^level grid over bounds
+// p is clamped to the bounds
+uint64 mortonEncode( const Box3& bounds, const vec3& p, int32 level );
+
+#endif
@@ -0,0 +1,91 @@
+//
+//  nodepool.h
+//
+
+#ifndef _NODEPOOL_H
+#define _NODEPOOL_H
+
+#include "Types.h"
+#include "Platform.h"
+
+#include <vector>
+#include <memory>
+
+// fixed size object pool
+// nodes are allocated in chunks and recycled through a free list.
+// a slot keeps its object constructed after it is freed, so the caller
+// must reset a node it gets back from alloc(). this also lets recycled
+// nodes keep storage their members already reserved.
+// chunks are arrays of N, so N must be default constructible
+template< typename N, size_t kChunkSize = 256 >
+class NodePool
+{
+public:
+
+	NodePool()
+	{
+		mNumUsed = 0;
+		mNumAllocated = 0;
+	}
+
+	N* alloc()
+	{
+		N* node;
+		if (mFree.size() > 0)
+		{
+			node = mFree.back();
+			mFree.pop_back();
+		}
+		else
+		{
+			size_t chunk = mNumUsed / kChunkSize;
+			if (chunk == mChunks.size())
+			{
+				mChunks.push_back( std::unique_ptr< N[] >( new N[ kChunkSize ] ));
+			}
+
+			node = &mChunks[ chunk ][ mNumUsed % kChunkSize ];
+			++mNumUsed;
+		}
+
+		++mNumAllocated;
+		return( node );
+	}
+
+	void free( N* node )
+	{
+		errorCheck( mNumAllocated > 0 );
+		--mNumAllocated;
+		mFree.push_back( node );
+	}
+
+	// release every node at once
+	// chunks are kept so the next allocations don't go to the heap
+	void reset()
+	{
+		mNumUsed = 0;
+		mNumAllocated = 0;
+		mFree.clear();
+	}
+
+	size_t getNumAllocated() const
+	{
+		return( mNumAllocated );
+	}
+
+	size_t getNumChunks() const
+	{
+		return( mChunks.size() );
+	}
+
+private:
+
+	std::vector< std::unique_ptr< N[] > > mChunks;
+	std::vector< N* > mFree;
+
+	// slots handed out from the chunks, not counting the free list
+	size_t mNumUsed;
+	size_t mNumAllocated;
+};
+
+#endif
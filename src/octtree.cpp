@@ -6,8 +6,27 @@
 
 #include "octtree.h"
 
+// child ray masks and leaf kernels use SSE2 or AVX where the compiler targets them
+// define OCTTREE_NO_SIMD to always use the plain version
+#if defined( OCTTREE_NO_SIMD )
+#elif defined( __AVX__ )
+#define OCTTREE_AVX
+#include <immintrin.h>
+#elif defined( __SSE2__ ) || defined( _M_X64 ) || (defined( _M_IX86_FP ) && _M_IX86_FP >= 2)
+#define OCTTREE_SSE2
+#include <emmintrin.h>
+#endif
+
 void split8( const Box3& box, std::vector< Box3 >& out )
 {
+    Box3 childBounds[ 8 ];
+    split8( box, childBounds );
+    out.insert( out.end(), childBounds, childBounds + 8 );
+}
+
+void split8( const Box3& box, Box3* out )
+{
+    int32 index = 0;
     vec3 childSize = box.getSize() / 2;
     vec3 offset = box.getSize() / 4;
     vec3 center = box.getCenter();
@@ -23,12 +42,495 @@ void split8( const Box3& box, std::vector< Box3 >& out )
                 childPos.mY += -offset.mY + (childSize.mY * y);
                 childPos.mZ += -offset.mZ + (childSize.mZ * z);
                 
-                Box3 childBounds( childPos - offset, childPos + offset );
-                out.push_back( childBounds );
+                out[ index++ ] = Box3( childPos - offset, childPos + offset );
             }
         }
     }
 }
 
+// children on each side of an axis, by the axis' 2 bit side mask
+static const uint32 kAxisChildren[ 3 ][ 4 ] =
+{
+	{ 0x00, 0x0f, 0xf0, 0xff },
+	{ 0x00, 0x33, 0xcc, 0xff },
+	{ 0x00, 0x55, 0xaa, 0xff }
+};
+
+uint32 getChildMask( const Box3& low, const Box3& high, const Box3& box )
+{
+	vec3 lowMin = low.getMin();
+	vec3 lowMax = low.getMax();
+	vec3 highMin = high.getMin();
+	vec3 highMax = high.getMax();
+	vec3 boxMin = box.getMin();
+	vec3 boxMax = box.getMax();
+	
+	uint32 mask = 0xff;
+	for( int32 j=0; j<3; ++j )
+	{
+		uint32 lowBit = (boxMin[ j ] <= lowMax[ j ] && boxMax[ j ] >= lowMin[ j ]) ? 1 : 0;
+		uint32 highBit = (boxMin[ j ] <= highMax[ j ] && boxMax[ j ] >= highMin[ j ]) ? 2 : 0;
+		mask &= kAxisChildren[ j ][ lowBit | highBit ];
+	}
+	
+	return( mask );
+}
+
+uint32 getChildMask( const Box3& low, const Box3& high, const vec3& p1, const vec3& p2, float64 radius )
+{
+	// t range of the ray inside each axis slab, for the low and high side
+	// same math as Box3::getRayEntry()
+	vec3 v = p2 - p1;
+	vec3 lowMin = low.getMin();
+	vec3 lowMax = low.getMax();
+	vec3 highMin = high.getMin();
+	vec3 highMax = high.getMax();
+	float64 tMins[ 3 ][ 2 ];
+	float64 tMaxs[ 3 ][ 2 ];
+	for( int32 j=0; j<3; ++j )
+	{
+		float64 lows[ 2 ] = { lowMin[ j ] - radius, highMin[ j ] - radius };
+		float64 highs[ 2 ] = { lowMax[ j ] + radius, highMax[ j ] + radius };
+		for( int32 side=0; side<2; ++side )
+		{
+			if (v[ j ] == 0)
+			{
+				bool inside = p1[ j ] >= lows[ side ] && p1[ j ] <= highs[ side ];
+				tMins[ j ][ side ] = inside ? 0 : 2;
+				tMaxs[ j ][ side ] = inside ? 1 : -1;
+			}
+			else
+			{
+				float64 t1 = (lows[ side ] - p1[ j ]) / v[ j ];
+				float64 t2 = (highs[ side ] - p1[ j ]) / v[ j ];
+				if (t1 > t2)
+				{
+					std::swap( t1, t2 );
+				}
+				
+				tMins[ j ][ side ] = std::max( t1, 0.0 );
+				tMaxs[ j ][ side ] = std::min( t2, 1.0 );
+			}
+		}
+	}
+	
+	// y and z sides are combined in 4 lanes, lane y * 2 + z, then each
+	// x side is applied to all 4. child index is x * 4 + lane
+	uint32 mask = 0;
+#if defined( OCTTREE_AVX )
+	__m256d yzMin = _mm256_max_pd(
+		_mm256_setr_pd( tMins[ 1 ][ 0 ], tMins[ 1 ][ 0 ], tMins[ 1 ][ 1 ], tMins[ 1 ][ 1 ] ),
+		_mm256_setr_pd( tMins[ 2 ][ 0 ], tMins[ 2 ][ 1 ], tMins[ 2 ][ 0 ], tMins[ 2 ][ 1 ] ));
+	__m256d yzMax = _mm256_min_pd(
+		_mm256_setr_pd( tMaxs[ 1 ][ 0 ], tMaxs[ 1 ][ 0 ], tMaxs[ 1 ][ 1 ], tMaxs[ 1 ][ 1 ] ),
+		_mm256_setr_pd( tMaxs[ 2 ][ 0 ], tMaxs[ 2 ][ 1 ], tMaxs[ 2 ][ 0 ], tMaxs[ 2 ][ 1 ] ));
+	for( int32 x=0; x<2; ++x )
+	{
+		__m256d tMin = _mm256_max_pd( yzMin, _mm256_set1_pd( tMins[ 0 ][ x ] ));
+		__m256d tMax = _mm256_min_pd( yzMax, _mm256_set1_pd( tMaxs[ 0 ][ x ] ));
+		mask |= static_cast< uint32 >( _mm256_movemask_pd( _mm256_cmp_pd( tMin, tMax, _CMP_LE_OQ ))) << (x * 4);
+	}
+#elif defined( OCTTREE_SSE2 )
+	for( int32 y=0; y<2; ++y )
+	{
+		// lanes y * 2 + 0 and y * 2 + 1
+		__m128d yzMin = _mm_max_pd( _mm_set1_pd( tMins[ 1 ][ y ] ), _mm_setr_pd( tMins[ 2 ][ 0 ], tMins[ 2 ][ 1 ] ));
+		__m128d yzMax = _mm_min_pd( _mm_set1_pd( tMaxs[ 1 ][ y ] ), _mm_setr_pd( tMaxs[ 2 ][ 0 ], tMaxs[ 2 ][ 1 ] ));
+		for( int32 x=0; x<2; ++x )
+		{
+			__m128d tMin = _mm_max_pd( yzMin, _mm_set1_pd( tMins[ 0 ][ x ] ));
+			__m128d tMax = _mm_min_pd( yzMax, _mm_set1_pd( tMaxs[ 0 ][ x ] ));
+			mask |= static_cast< uint32 >( _mm_movemask_pd( _mm_cmple_pd( tMin, tMax ))) << (x * 4 + y * 2);
+		}
+	}
+#else
+	for( int32 c=0; c<8; ++c )
+	{
+		int32 x = (c >> 2) & 1;
+		int32 y = (c >> 1) & 1;
+		int32 z = c & 1;
+		float64 tMin = std::max( std::max( tMins[ 0 ][ x ], tMins[ 1 ][ y ] ), tMins[ 2 ][ z ] );
+		float64 tMax = std::min( std::min( tMaxs[ 0 ][ x ], tMaxs[ 1 ][ y ] ), tMaxs[ 2 ][ z ] );
+		if (tMin <= tMax)
+		{
+			mask |= (1 << c);
+		}
+	}
+#endif
+	
+	return( mask );
+}
+
+// lane types for getChildRays()
+#if defined( OCTTREE_AVX )
+static const int32 kRayLanes = 4;
+typedef __m256d RayLanes;
+#define rayLoad( a, b, c, d ) _mm256_setr_pd( a, b, c, d )
+#define raySet1 _mm256_set1_pd
+#define rayAdd _mm256_add_pd
+#define raySub _mm256_sub_pd
+#define rayDiv _mm256_div_pd
+#define rayMin _mm256_min_pd
+#define rayMax _mm256_max_pd
+#define rayAnd _mm256_and_pd
+#define rayBlend _mm256_blendv_pd
+#define rayLE( a, b ) _mm256_cmp_pd( a, b, _CMP_LE_OQ )
+#define rayGE( a, b ) _mm256_cmp_pd( a, b, _CMP_GE_OQ )
+#define rayEQ( a, b ) _mm256_cmp_pd( a, b, _CMP_EQ_OQ )
+#define rayMoveMask _mm256_movemask_pd
+#elif defined( OCTTREE_SSE2 )
+static const int32 kRayLanes = 2;
+typedef __m128d RayLanes;
+#define rayLoad( a, b, c, d ) _mm_setr_pd( a, b )
+#define raySet1 _mm_set1_pd
+#define rayAdd _mm_add_pd
+#define raySub _mm_sub_pd
+#define rayDiv _mm_div_pd
+#define rayMin _mm_min_pd
+#define rayMax _mm_max_pd
+#define rayAnd _mm_and_pd
+#define rayBlend( a, b, mask ) _mm_or_pd( _mm_andnot_pd( mask, a ), _mm_and_pd( mask, b ))
+#define rayLE _mm_cmple_pd
+#define rayGE _mm_cmpge_pd
+#define rayEQ _mm_cmpeq_pd
+#define rayMoveMask _mm_movemask_pd
+#endif
+
+void getChildRays( const Box3& low, const Box3& high, const vec3* p1s, const vec3* p2s,
+	const float64* radii, int32 numRays, uint32 rayMask, uint32* childRaysOut )
+{
+	for( int32 c=0; c<8; ++c )
+	{
+		childRaysOut[ c ] = 0;
+	}
+	
+#if defined( OCTTREE_AVX ) || defined( OCTTREE_SSE2 )
+	// same steps as getChildMask(), with a ray per lane
+	vec3 lowMin = low.getMin();
+	vec3 lowMax = low.getMax();
+	vec3 highMin = high.getMin();
+	vec3 highMax = high.getMax();
+	for( int32 first=0; first<numRays; first+=kRayLanes )
+	{
+		uint32 laneMask = (rayMask >> first) & ((1 << kRayLanes) - 1);
+		if (laneMask == 0)
+		{
+			continue;
+		}
+		
+		// lanes past numRays repeat the last ray and are masked off
+		int32 rays[ 4 ];
+		for( int32 lane=0; lane<4; ++lane )
+		{
+			rays[ lane ] = std::min( first + lane, numRays - 1 );
+		}
+		
+		vec3 v[ 4 ];
+		for( int32 lane=0; lane<4; ++lane )
+		{
+			v[ lane ] = p2s[ rays[ lane ] ] - p1s[ rays[ lane ] ];
+		}
+		
+		RayLanes radius = rayLoad( radii[ rays[ 0 ] ], radii[ rays[ 1 ] ], radii[ rays[ 2 ] ], radii[ rays[ 3 ] ] );
+		RayLanes tMins[ 3 ][ 2 ];
+		RayLanes tMaxs[ 3 ][ 2 ];
+		for( int32 j=0; j<3; ++j )
+		{
+			RayLanes p = rayLoad( p1s[ rays[ 0 ] ][ j ], p1s[ rays[ 1 ] ][ j ], p1s[ rays[ 2 ] ][ j ], p1s[ rays[ 3 ] ][ j ] );
+			RayLanes vj = rayLoad( v[ 0 ][ j ], v[ 1 ][ j ], v[ 2 ][ j ], v[ 3 ][ j ] );
+			RayLanes still = rayEQ( vj, raySet1( 0 ));
+			
+			float64 sideMins[ 2 ] = { lowMin[ j ], highMin[ j ] };
+			float64 sideMaxs[ 2 ] = { lowMax[ j ], highMax[ j ] };
+			for( int32 side=0; side<2; ++side )
+			{
+				RayLanes lows = raySub( raySet1( sideMins[ side ] ), radius );
+				RayLanes highs = rayAdd( raySet1( sideMaxs[ side ] ), radius );
+				RayLanes t1 = rayDiv( raySub( lows, p ), vj );
+				RayLanes t2 = rayDiv( raySub( highs, p ), vj );
+				RayLanes tMin = rayMax( rayMin( t1, t2 ), raySet1( 0 ));
+				RayLanes tMax = rayMin( rayMax( t1, t2 ), raySet1( 1 ));
+				
+				// a ray still on this axis is inside the slab or not
+				RayLanes inside = rayAnd( rayGE( p, lows ), rayLE( p, highs ));
+				tMins[ j ][ side ] = rayBlend( tMin, rayBlend( raySet1( 2 ), raySet1( 0 ), inside ), still );
+				tMaxs[ j ][ side ] = rayBlend( tMax, rayBlend( raySet1( -1 ), raySet1( 1 ), inside ), still );
+			}
+		}
+		
+		for( int32 c=0; c<8; ++c )
+		{
+			int32 x = (c >> 2) & 1;
+			int32 y = (c >> 1) & 1;
+			int32 z = c & 1;
+			RayLanes tMin = rayMax( rayMax( tMins[ 0 ][ x ], tMins[ 1 ][ y ] ), tMins[ 2 ][ z ] );
+			RayLanes tMax = rayMin( rayMin( tMaxs[ 0 ][ x ], tMaxs[ 1 ][ y ] ), tMaxs[ 2 ][ z ] );
+			childRaysOut[ c ] |= (static_cast< uint32 >( rayMoveMask( rayLE( tMin, tMax ))) & laneMask) << first;
+		}
+	}
+#else
+	for( int32 ray=0; ray<numRays; ++ray )
+	{
+		if (rayMask & (1 << ray))
+		{
+			uint32 mask = getChildMask( low, high, p1s[ ray ], p2s[ ray ], radii[ ray ] );
+			for( int32 c=0; c<8; ++c )
+			{
+				if (mask & (1 << c))
+				{
+					childRaysOut[ c ] |= (1 << ray);
+				}
+			}
+		}
+	}
+#endif
+}
+
+// getCollision( p1, v, p, radius + itemRadius ) of one item
+// v3 is -v and a is its length squared, as in getCollision()
+static inline bool getBeamHit( float32 x, float32 y, float32 z, float64 itemRadius,
+	const vec3& p1, const vec3& v3, float64 a, float64 radius, float64& tOut )
+{
+	// p3 is made in float32 like vec3 subtraction
+	float64 px = x - p1.mX;
+	float64 py = y - p1.mY;
+	float64 pz = z - p1.mZ;
+	float64 dist = radius + itemRadius;
+	if (a == 0)
+	{
+		// still beam, lengthVec() of p1 - p
+		float32 dx = p1.mX - x;
+		float32 dy = p1.mY - y;
+		float32 dz = p1.mZ - z;
+		tOut = 0;
+		return( sqrt( static_cast< float64 >( dx * dx ) + (dy * dy) + (dz * dz) ) <= dist );
+	}
+	
+	float64 b = (2.0 * px * v3.mX) + (2.0 * py * v3.mY) + (2.0 * pz * v3.mZ);
+	float64 c = (px * px) + (py * py) + (pz * pz) - (dist * dist);
+	float64 disc = (b * b) - (4 * a * c);
+	if (disc < 0)
+	{
+		return( false );
+	}
+	
+	// one root is the same as two equal roots
+	float64 s = sqrt( disc );
+	float64 sol1 = (-b - s) / (2 * a);
+	float64 sol2 = (-b + s) / (2 * a);
+	if (sol2 < 0 || sol1 > 1)
+	{
+		return( false );
+	}
+	
+	// getCollision() returns t as a float32
+	tOut = static_cast< float32 >( sol1 < 0 ? 0 : sol1 );
+	return( true );
+}
+
+// items first to count - 1 of getBoxHits()
+// same test as LeafBucket::intersects()
+static uint32 getBoxHitRange( const float32* x, const float32* y, const float32* z, const float64* radius,
+	size_t first, size_t count, const vec3& boundsMin, const vec3& boundsMax )
+{
+	uint32 mask = 0;
+	for( size_t i=first; i<count; ++i )
+	{
+		float32 r = static_cast< float32 >( radius[ i ] );
+		if (x[ i ] - r <= boundsMax.mX
+			&& y[ i ] - r <= boundsMax.mY
+			&& z[ i ] - r <= boundsMax.mZ
+			&& x[ i ] + r >= boundsMin.mX
+			&& y[ i ] + r >= boundsMin.mY
+			&& z[ i ] + r >= boundsMin.mZ)
+		{
+			mask |= (1 << i);
+		}
+	}
+	
+	return( mask );
+}
 
+// items first to count - 1 of getBeamHits()
+static uint32 getBeamHitRange( const float32* x, const float32* y, const float32* z, const float64* itemRadius,
+	size_t first, size_t count, const vec3& p1, const vec3& v3, float64 a, float64 radius, float64* tsOut )
+{
+	uint32 mask = 0;
+	for( size_t i=first; i<count; ++i )
+	{
+		if (getBeamHit( x[ i ], y[ i ], z[ i ], itemRadius[ i ], p1, v3, a, radius, tsOut[ i ] ))
+		{
+			mask |= (1 << i);
+		}
+	}
+	
+	return( mask );
+}
+
+uint32 getBoxHitsScalar( const float32* x, const float32* y, const float32* z, const float64* radius,
+	size_t count, const vec3& boundsMin, const vec3& boundsMax )
+{
+	errorCheck( count <= 8 );
+	return( getBoxHitRange( x, y, z, radius, 0, count, boundsMin, boundsMax ));
+}
 
+uint32 getBeamHitsScalar( const float32* x, const float32* y, const float32* z, const float64* itemRadius,
+	size_t count, const vec3& p1, const vec3& v, float64 radius, float64* tsOut )
+{
+	errorCheck( count <= 8 );
+	
+	vec3 v3( -v.mX, -v.mY, -v.mZ );
+	float64 a = (static_cast< float64 >( v3.mX ) * v3.mX) + (static_cast< float64 >( v3.mY ) * v3.mY)
+		+ (static_cast< float64 >( v3.mZ ) * v3.mZ);
+	return( getBeamHitRange( x, y, z, itemRadius, 0, count, p1, v3, a, radius, tsOut ));
+}
+
+uint32 getBoxHits( const float32* x, const float32* y, const float32* z, const float64* radius,
+	size_t count, const vec3& boundsMin, const vec3& boundsMax )
+{
+	errorCheck( count <= 8 );
+	
+	uint32 mask = 0;
+	size_t i = 0;
+#if defined( OCTTREE_AVX )
+	if (count == 8)
+	{
+		__m256 r = _mm256_insertf128_ps( _mm256_castps128_ps256( _mm256_cvtpd_ps( _mm256_loadu_pd( radius ))),
+			_mm256_cvtpd_ps( _mm256_loadu_pd( radius + 4 )), 1 );
+		__m256 px = _mm256_loadu_ps( x );
+		__m256 py = _mm256_loadu_ps( y );
+		__m256 pz = _mm256_loadu_ps( z );
+		__m256 hit = _mm256_and_ps(
+			_mm256_and_ps( _mm256_cmp_ps( _mm256_sub_ps( px, r ), _mm256_set1_ps( boundsMax.mX ), _CMP_LE_OQ ),
+				_mm256_cmp_ps( _mm256_add_ps( px, r ), _mm256_set1_ps( boundsMin.mX ), _CMP_GE_OQ )),
+			_mm256_and_ps(
+				_mm256_and_ps( _mm256_cmp_ps( _mm256_sub_ps( py, r ), _mm256_set1_ps( boundsMax.mY ), _CMP_LE_OQ ),
+					_mm256_cmp_ps( _mm256_add_ps( py, r ), _mm256_set1_ps( boundsMin.mY ), _CMP_GE_OQ )),
+				_mm256_and_ps( _mm256_cmp_ps( _mm256_sub_ps( pz, r ), _mm256_set1_ps( boundsMax.mZ ), _CMP_LE_OQ ),
+					_mm256_cmp_ps( _mm256_add_ps( pz, r ), _mm256_set1_ps( boundsMin.mZ ), _CMP_GE_OQ ))));
+		return( static_cast< uint32 >( _mm256_movemask_ps( hit )));
+	}
+#elif defined( OCTTREE_SSE2 )
+	for( ; i + 4 <= count; i += 4 )
+	{
+		__m128 r = _mm_movelh_ps( _mm_cvtpd_ps( _mm_loadu_pd( radius + i )),
+			_mm_cvtpd_ps( _mm_loadu_pd( radius + i + 2 )));
+		__m128 px = _mm_loadu_ps( x + i );
+		__m128 py = _mm_loadu_ps( y + i );
+		__m128 pz = _mm_loadu_ps( z + i );
+		__m128 hit = _mm_and_ps(
+			_mm_and_ps( _mm_cmple_ps( _mm_sub_ps( px, r ), _mm_set1_ps( boundsMax.mX )),
+				_mm_cmpge_ps( _mm_add_ps( px, r ), _mm_set1_ps( boundsMin.mX ))),
+			_mm_and_ps(
+				_mm_and_ps( _mm_cmple_ps( _mm_sub_ps( py, r ), _mm_set1_ps( boundsMax.mY )),
+					_mm_cmpge_ps( _mm_add_ps( py, r ), _mm_set1_ps( boundsMin.mY ))),
+				_mm_and_ps( _mm_cmple_ps( _mm_sub_ps( pz, r ), _mm_set1_ps( boundsMax.mZ )),
+					_mm_cmpge_ps( _mm_add_ps( pz, r ), _mm_set1_ps( boundsMin.mZ )))));
+		mask |= static_cast< uint32 >( _mm_movemask_ps( hit )) << i;
+	}
+#endif
+	
+	return( mask | getBoxHitRange( x, y, z, radius, i, count, boundsMin, boundsMax ));
+}
+
+uint32 getBeamHits( const float32* x, const float32* y, const float32* z, const float64* itemRadius,
+	size_t count, const vec3& p1, const vec3& v, float64 radius, float64* tsOut )
+{
+	errorCheck( count <= 8 );
+	
+	vec3 v3( -v.mX, -v.mY, -v.mZ );
+	float64 a = (static_cast< float64 >( v3.mX ) * v3.mX) + (static_cast< float64 >( v3.mY ) * v3.mY)
+		+ (static_cast< float64 >( v3.mZ ) * v3.mZ);
+	
+	uint32 mask = 0;
+	size_t i = 0;
+	
+	// the quadratic is done 2 or 4 items at a time, in float64 like getCollision()
+	// a still beam is left to getBeamHit()
+#if defined( OCTTREE_AVX )
+	if (a != 0)
+	{
+		__m256d negZero = _mm256_set1_pd( -0.0 );
+		__m256d two = _mm256_set1_pd( 2.0 );
+		__m256d vx = _mm256_set1_pd( v3.mX );
+		__m256d vy = _mm256_set1_pd( v3.mY );
+		__m256d vz = _mm256_set1_pd( v3.mZ );
+		__m256d fourA = _mm256_set1_pd( 4 * a );
+		__m256d twoA = _mm256_set1_pd( 2 * a );
+		for( ; i + 4 <= count; i += 4 )
+		{
+			__m256d px = _mm256_cvtps_pd( _mm_sub_ps( _mm_loadu_ps( x + i ), _mm_set1_ps( p1.mX )));
+			__m256d py = _mm256_cvtps_pd( _mm_sub_ps( _mm_loadu_ps( y + i ), _mm_set1_ps( p1.mY )));
+			__m256d pz = _mm256_cvtps_pd( _mm_sub_ps( _mm_loadu_ps( z + i ), _mm_set1_ps( p1.mZ )));
+			__m256d dist = _mm256_add_pd( _mm256_set1_pd( radius ), _mm256_loadu_pd( itemRadius + i ));
+			
+			__m256d b = _mm256_add_pd( _mm256_add_pd(
+				_mm256_mul_pd( _mm256_mul_pd( two, px ), vx ),
+				_mm256_mul_pd( _mm256_mul_pd( two, py ), vy )),
+				_mm256_mul_pd( _mm256_mul_pd( two, pz ), vz ));
+			__m256d c = _mm256_sub_pd( _mm256_add_pd( _mm256_add_pd(
+				_mm256_mul_pd( px, px ), _mm256_mul_pd( py, py )), _mm256_mul_pd( pz, pz )),
+				_mm256_mul_pd( dist, dist ));
+			__m256d disc = _mm256_sub_pd( _mm256_mul_pd( b, b ), _mm256_mul_pd( fourA, c ));
+			
+			__m256d s = _mm256_sqrt_pd( _mm256_max_pd( disc, _mm256_setzero_pd() ));
+			__m256d negB = _mm256_xor_pd( b, negZero );
+			__m256d sol1 = _mm256_div_pd( _mm256_sub_pd( negB, s ), twoA );
+			__m256d sol2 = _mm256_div_pd( _mm256_add_pd( negB, s ), twoA );
+			__m256d hit = _mm256_and_pd( _mm256_cmp_pd( disc, _mm256_setzero_pd(), _CMP_GE_OQ ),
+				_mm256_and_pd( _mm256_cmp_pd( sol2, _mm256_setzero_pd(), _CMP_GE_OQ ),
+					_mm256_cmp_pd( sol1, _mm256_set1_pd( 1.0 ), _CMP_LE_OQ )));
+			
+			// t is rounded to float32, see getBeamHit()
+			__m256d t = _mm256_cvtps_pd( _mm256_cvtpd_ps( _mm256_max_pd( sol1, _mm256_setzero_pd() )));
+			_mm256_storeu_pd( tsOut + i, t );
+			mask |= static_cast< uint32 >( _mm256_movemask_pd( hit )) << i;
+		}
+	}
+#elif defined( OCTTREE_SSE2 )
+	if (a != 0)
+	{
+		__m128d negZero = _mm_set1_pd( -0.0 );
+		__m128d two = _mm_set1_pd( 2.0 );
+		__m128d vx = _mm_set1_pd( v3.mX );
+		__m128d vy = _mm_set1_pd( v3.mY );
+		__m128d vz = _mm_set1_pd( v3.mZ );
+		__m128d fourA = _mm_set1_pd( 4 * a );
+		__m128d twoA = _mm_set1_pd( 2 * a );
+		for( ; i + 2 <= count; i += 2 )
+		{
+			// 2 floats from each array
+			__m128d px = _mm_cvtps_pd( _mm_sub_ps( _mm_castpd_ps( _mm_load_sd( reinterpret_cast< const float64* >( x + i ))),
+				_mm_set1_ps( p1.mX )));
+			__m128d py = _mm_cvtps_pd( _mm_sub_ps( _mm_castpd_ps( _mm_load_sd( reinterpret_cast< const float64* >( y + i ))),
+				_mm_set1_ps( p1.mY )));
+			__m128d pz = _mm_cvtps_pd( _mm_sub_ps( _mm_castpd_ps( _mm_load_sd( reinterpret_cast< const float64* >( z + i ))),
+				_mm_set1_ps( p1.mZ )));
+			__m128d dist = _mm_add_pd( _mm_set1_pd( radius ), _mm_loadu_pd( itemRadius + i ));
+			
+			__m128d b = _mm_add_pd( _mm_add_pd(
+				_mm_mul_pd( _mm_mul_pd( two, px ), vx ),
+				_mm_mul_pd( _mm_mul_pd( two, py ), vy )),
+				_mm_mul_pd( _mm_mul_pd( two, pz ), vz ));
+			__m128d c = _mm_sub_pd( _mm_add_pd( _mm_add_pd(
+				_mm_mul_pd( px, px ), _mm_mul_pd( py, py )), _mm_mul_pd( pz, pz )),
+				_mm_mul_pd( dist, dist ));
+			__m128d disc = _mm_sub_pd( _mm_mul_pd( b, b ), _mm_mul_pd( fourA, c ));
+			
+			__m128d s = _mm_sqrt_pd( _mm_max_pd( disc, _mm_setzero_pd() ));
+			__m128d negB = _mm_xor_pd( b, negZero );
+			__m128d sol1 = _mm_div_pd( _mm_sub_pd( negB, s ), twoA );
+			__m128d sol2 = _mm_div_pd( _mm_add_pd( negB, s ), twoA );
+			__m128d hit = _mm_and_pd( _mm_cmpge_pd( disc, _mm_setzero_pd() ),
+				_mm_and_pd( _mm_cmpge_pd( sol2, _mm_setzero_pd() ), _mm_cmple_pd( sol1, _mm_set1_pd( 1.0 ))));
+			
+			// t is rounded to float32, see getBeamHit()
+			__m128d t = _mm_cvtps_pd( _mm_cvtpd_ps( _mm_max_pd( sol1, _mm_setzero_pd() )));
+			_mm_storeu_pd( tsOut + i, t );
+			mask |= static_cast< uint32 >( _mm_movemask_pd( hit )) << i;
+		}
+	}
+#endif
+	
+	return( mask | getBeamHitRange( x, y, z, itemRadius, i, count, p1, v3, a, radius, tsOut ));
+}
@@ -13,24 +13,99 @@
 
 #include "vec3.h"
 #include "box3.h"
+#include "nodepool.h"
+#include "itemtable.h"
+#include "morton.h"
+#include "threadpool.h"
 
 #include <vector>
-#include <map>
 #include <set>
 #include <algorithm>
+#include <memory>
+#include <mutex>
+#include <type_traits>
 
 template< typename T > class VoxelItem;
 template< typename T > class Voxel;
+template< typename T > class VoxelBlock;
+template< typename T > class NodeArena;
 
 // split a box into 8 equal parts
 void split8( const Box3& box, std::vector< Box3 >& out );
+void split8( const Box3& box, Box3* out );
 
+// bit c is set if child c from split8() touches a query
+// low and high are children 0 and 7, which give the 2 sides of each axis
+uint32 getChildMask( const Box3& low, const Box3& high, const Box3& box );
+
+// beam version, same result as Box3::getRayEntry() >= 0 for each child.
+// done 4 or 8 children at a time with SSE2 or AVX
+uint32 getChildMask( const Box3& low, const Box3& high, const vec3& p1, const vec3& p2, float64 radius );
+
+// getChildMask() of up to 32 beams at once
+// bit i of childRaysOut[ c ] is set if ray i is in rayMask and enters
+// child c. rays are done 2 or 4 at a time with SSE2 or AVX
+void getChildRays( const Box3& low, const Box3& high, const vec3* p1s, const vec3* p2s,
+	const float64* radii, int32 numRays, uint32 rayMask, uint32* childRaysOut );
+
+// leaf kernels, test up to 8 items from SoA arrays at once
+// bit i is set if item i is hit.
+// box hits are LeafBucket::intersects(), beam hits are
+// getCollision( p1, v, p, radius + itemRadius ) >= 0 with the t of
+// each hit in tsOut. done 4 or 8 items at a time with SSE2 or AVX
+uint32 getBoxHits( const float32* x, const float32* y, const float32* z, const float64* radius,
+	size_t count, const vec3& boundsMin, const vec3& boundsMax );
+uint32 getBeamHits( const float32* x, const float32* y, const float32* z, const float64* itemRadius,
+	size_t count, const vec3& p1, const vec3& v, float64 radius, float64* tsOut );
+
+// plain versions of the leaf kernels, what OCTTREE_NO_SIMD builds run
+// built either way so the SIMD paths can be checked against them
+uint32 getBoxHitsScalar( const float32* x, const float32* y, const float32* z, const float64* radius,
+	size_t count, const vec3& boundsMin, const vec3& boundsMax );
+uint32 getBeamHitsScalar( const float32* x, const float32* y, const float32* z, const float64* itemRadius,
+	size_t count, const vec3& p1, const vec3& v, float64 radius, float64* tsOut );
+
+// view of a range of item pointers
+// lets a split policy run on part of a build list
+template< typename TItem >
+class ItemSpan
+{
+public:
+	
+	ItemSpan( TItem* const* first, TItem* const* last )
+	{
+		mFirst = first;
+		mLast = last;
+	}
+	
+	size_t size() const
+	{
+		return( mLast - mFirst );
+	}
+	
+	TItem* const* begin() const
+	{
+		return( mFirst );
+	}
+	
+	TItem* const* end() const
+	{
+		return( mLast );
+	}
+	
+private:
+	
+	TItem* const* mFirst;
+	TItem* const* mLast;
+};
+
+// input to octTree::build() and octTree::updateMany()
 template< typename T >
-class VoxelItem
+class BuildItem
 {
 public:
 	
-	VoxelItem( T item, const vec3& p, float64 radius )
+	BuildItem( T item, const vec3& p, float64 radius )
 	{
 		mItem = item;
 		mPos = p;
@@ -40,635 +115,2753 @@ public:
 	T mItem;
 	vec3 mPos;
 	float64 mRadius;
-	std::vector< Voxel< T >* > mVoxels;
 };
 
+// item hit by octTree::sweepSphere()
+// mT is the time of impact over the step, 0 to 1
 template< typename T >
-class Voxel
+class SweepHit
 {
 public:
 	
-	Voxel( Voxel* parent, const Box3& bounds )
+	SweepHit( T item, float64 t )
 	{
-		mParent = parent;
-		mBounds = bounds;
-        mNumItems = 0;
+		mItem = item;
+		mT = t;
 	}
 	
-	~Voxel()
+	T mItem;
+	float64 mT;
+};
+
+// one query of octTree::getItemsBatch() or queryParallel(), same as getItems( p, radius )
+class ItemQuery
+{
+public:
+	
+	ItemQuery( const vec3& p, float64 radius )
 	{
-		for( Voxel<T>* child : mChildren )
-		{
-			delete child;
-		}
+		mPos = p;
+		mRadius = radius;
 	}
 	
-	// not divisible add
-    // for leafs only
-	void add( VoxelItem<T>* item )
+	vec3 mPos;
+	float64 mRadius;
+};
+
+// one query of octTree::queryParallel(), same as getItems( p1, p2, radius )
+class BeamQuery
+{
+public:
+	
+	BeamQuery( const vec3& p1, const vec3& p2, float64 radius )
 	{
-        errorCheck( mChildren.size() == 0 );
-		auto insertResult = mItems.insert( item );
-		errorCheck( insertResult.second == true );
-		item->mVoxels.push_back( this );
+		mP1 = p1;
+		mP2 = p2;
+		mRadius = radius;
 	}
 	
-	void add( VoxelItem<T>* item, const Box3& bounds, float64 minVoxelSize )
+	vec3 mP1;
+	vec3 mP2;
+	float64 mRadius;
+};
+
+// one query of octTree::queryParallel(), same as getNearest( p, k, maxDist )
+class NearestQuery
+{
+public:
+	
+	NearestQuery( const vec3& p, size_t k, float64 maxDist )
 	{
-        if (mBounds.intersects( bounds ) == false)
-        {
-            // not added to this voxel
-        }
-        else
-        {
-            mNumItems++;
-            if (mChildren.size() == 0)
-            {
-                // root case - no children
-                add( item );
-                divide( minVoxelSize );
-            }
-            else
-            {
-                // add to children
-                for( Voxel<T>* child : mChildren )
-                {
-					child->add( item, bounds, minVoxelSize );
-				}
-			}
-		}
+		mPos = p;
+		mK = k;
+		mMaxDist = maxDist;
 	}
 	
-    // for leafs only
-	void remove( VoxelItem<T>* item )
+	vec3 mPos;
+	size_t mK;
+	float64 mMaxDist;
+};
+
+// results of octTree::getItemsBatch() or queryParallel(), packed in query order
+// items of query i are mItems[ mOffsets[ i ] ] to mItems[ mOffsets[ i + 1 ] - 1 ]
+template< typename T >
+class BatchResult
+{
+public:
+	
+	size_t getNumQueries() const
 	{
-        //errorCheck( mChildren.size() == 0 );
-		auto iter = std::find( item->mVoxels.begin(), item->mVoxels.end(), this );
-		errorCheck( iter != item->mVoxels.end() );
-		item->mVoxels.erase( iter );
-		size_t num = this->mItems.erase( item );
-		errorCheck( num == 1 );
-        
-        // voxels items must match
-        //errorCheck( mNumItems == mItems.size() );
+		return( mOffsets.size() > 0 ? mOffsets.size() - 1 : 0 );
 	}
 	
-    // todo: trivial collapse: only collapse voxels when ir has only 1 or 0 items.
-	void remove( VoxelItem<T>* item, const Box3& bounds, float64 minVoxelSize, bool combineVoxels )
+	size_t getNumItems( size_t query ) const
 	{
-		if (mBounds.intersects( bounds ) == false)
-		{
-			// item can't be in this voxel
-			return;
-		}
-		
-        errorCheck( mNumItems > 0 );
-        --mNumItems;
-        
-		for( Voxel<T>* child : mChildren )
-		{
-			child->remove( item, bounds, minVoxelSize, combineVoxels );
-		}
+		return( mOffsets[ query + 1 ] - mOffsets[ query ] );
+	}
+	
+	const T* getItems( size_t query ) const
+	{
+		return( mItems.data() + mOffsets[ query ] );
+	}
+	
+	std::vector< uint32 > mOffsets;
+	std::vector< T > mItems;
+};
+
+// beams (lines with radius) queried together, see octTree::getItems()
+// coherent beams share the upper voxels of their walk. 4, 8 or 16 is usual
+class RayPacket
+{
+public:
+	
+	static constexpr int32 kMaxRays = PacketMailbox::kMaxRays;
+	
+	RayPacket()
+	{
+		mNumRays = 0;
+	}
+	
+	// returns the ray's index in the packet
+	int32 add( const vec3& p1, const vec3& p2, float64 radius )
+	{
+		errorCheck( mNumRays < kMaxRays );
 		
-		if (mChildren.size() == 0)
-		{
-			// item must be attached to this leaf voxel
-			auto iter = mItems.find( item );
-			errorCheck( iter != mItems.end() );
-			mItems.erase( iter );
-			
-			auto iter2 = std::find( item->mVoxels.begin(),
-				item->mVoxels.end(), this );
-			errorCheck( iter2 != item->mVoxels.end() );
-			item->mVoxels.erase( iter2 );
-		}
-		 
-        // do trival combines
-        if (mNumItems == 0
-            && mChildren.size() > 0)
-        {
-            for( Voxel<T>* child : mChildren )
-            {
-                // must be only 1 level deep
-                errorCheck( child->mChildren.size() == 0 );
-                delete child;
-            }
-            
-            mChildren.clear();
-        }
-        
-        if (mNumItems == 1
-            && mChildren.size() > 0)
-        {
-            VoxelItem<T>* item2 = nullptr;
-            for (Voxel<T>* child : mChildren )
-            {
-                errorCheck( child->mChildren.size() == 0 );
-                if (child->mItems.size() > 0)
-                {
-                    VoxelItem<T>* item3 = *(child->mItems.begin());
-                    if (item2 == nullptr)
-                    {
-                        item2 = item3;
-                    }
-                    else
-                    {
-                        errorCheck( item2 == item3 );
-                    }
-
-                    child->remove( item3 );
-                    delete child;
-                }
-            }
+		mP1[ mNumRays ] = p1;
+		mP2[ mNumRays ] = p2;
+		mV[ mNumRays ] = p2 - p1;
+		mRadius[ mNumRays ] = radius;
+		return( mNumRays++ );
+	}
+	
+	void clear()
+	{
+		mNumRays = 0;
+	}
+	
+	vec3 mP1[ kMaxRays ];
+	vec3 mP2[ kMaxRays ];
+	
+	// p2 - p1
+	vec3 mV[ kMaxRays ];
+	float64 mRadius[ kMaxRays ];
+	int32 mNumRays;
+};
 
-            errorCheck( item2 != nullptr );
-            mChildren.clear();
-            this->add( item2 );
-        }
-        
-        return;
-        
-//        // look to see if children need to be combined
-//        // temp skip the recombine
-//        if (combineVoxels == false)
-//        {
-//            return;
-//        }
-//
-//        if (mChildren.size() > 0)
-//        {
-//            // see if all children are eligible for combine
-//            // must be leafs
-//            bool combine = true;
-//            std::set< VoxelItem<T>* > items;
-//            float64 maxDist;
-//
-//            // first check if all children are leafs
-//            for( Voxel<T>* child : mChildren)
-//            {
-//                if (child->mChildren.size() > 0)
-//                {
-//                    combine = false;
-//                    break;
-//                }
-//            }
-//
-//            // next check if dist is great enoug between furtherest objects
-//            if (combine)
-//            {
-//                for( Voxel<T>* child : mChildren)
-//                {
-//                    if (child->isReducible( child->mItems, child->getVoxelSize(), minVoxelSize, maxDist ) == false)
-//                    {
-//                        // don't change
-//                        for( VoxelItem<T>* item : child->mItems )
-//                        {
-//                            items.insert( item );
-//                        }
-//                    }
-//                    else
-//                    {
-//                        combine = false;
-//                        break;
-//                    }
-//                }
-//            }
-//
-//            if (combine
-//                && isReducible( items, getVoxelSize(), minVoxelSize, maxDist ) == false)
-//            {
-//                // combine all childen
-//                for( Voxel<T>* child : mChildren )
-//                {
-//                    // must be leaf
-//                    errorCheck( child->mChildren.size() == 0 );
-//
-//                    for( ; child->mItems.size() > 0; )
-//                    {
-//                        VoxelItem<T>* item = *(child->mItems.begin());
-//                        child->remove( item );
-//                    }
-//
-//                    delete child;
-//                }
-//
-//                mChildren.clear();
-//
-//                errorCheck( mItems.size() == 0 );
-//                for( VoxelItem<T>* item : items )
-//                {
-//                    add( item );
-//                }
-//            }
-//        }
+// one item of an octTree::updateMany() batch
+// the item already has its new position
+template< typename T >
+class ItemMove
+{
+public:
+	
+	ItemMove( VoxelItem< T >* item, const Box3& oldBox, const Box3& newBox )
+	{
+		mItem = item;
+		mOldBox = oldBox;
+		mNewBox = newBox;
 	}
+	
+	VoxelItem< T >* mItem;
+	Box3 mOldBox;
+	Box3 mNewBox;
+};
 
-	// check for combining a space of voxels
-	void combine( const Box3& bounds, float64 minVoxelSize )
+// items can be split apart if they are far enough apart on an axis
+// TItems is a container of item pointers (needing mPos and mRadius)
+template< typename TItems >
+bool isReducible( const TItems& items, float64 voxelSize, float64 minVoxelSize,
+	float64& maxAlignedDistOut )
+{
+	bool result;
+	maxAlignedDistOut = 0;
+	
+	// assume this is a leaf node
+	// have to iterate over all children check if it can combine children
+	//errorCheck( isLeaf() );
+
+	if (items.size() <= 1)
 	{
-		if (mBounds.intersects( bounds ) == false)
+		// can't get below 1 in all blocks
+		result = false;
+	}
+	else if (voxelSize <= minVoxelSize)
+	{
+		// can't go any smaller
+		result = false;
+	}
+	else
+	{
+		// if smallest item is at least 2 min radii away from closest object,
+		// then it can be split
+		auto min = *(items.begin());
+		for( auto item : items )
 		{
-			// item can't be in this voxel
-			return;
+			if (item->mRadius < min->mRadius)
+			{
+				min = item;
+			}
 		}
 		
-		for( Voxel<T>* child : mChildren )
+		// max aligned dist
+		// since voxels will be aligned to axis
+		float64 maxAlignedDist = 0;
+		for( auto item : items )
 		{
-			child->combine( bounds, minVoxelSize );
+			if (item != min)
+			{
+				for( int i=0; i<3; ++i )
+				{
+					float64 dist = fabs( item->mPos[ 0 ] - min->mPos[ 0 ] )
+						- item->mRadius - min->mRadius;
+					if (dist > maxAlignedDist)
+					{
+						maxAlignedDist = dist;
+					}
+				}
+			}
 		}
 		
-		if (mChildren.size() > 0)
+		maxAlignedDistOut = maxAlignedDist;
+		if (maxAlignedDist > minVoxelSize)
 		{
-			// see if all children are eligible for combine
-			// must be leafs
-			bool combine = true;
-			std::set< VoxelItem<T>* > items;
+			result = true;
+		}
+		else
+		{
+			result = false;
+		}
+	}
+
+	return( result );
+}
+
+// item spheres touch, used by the pair queries
+// differences are taken in float64, so close items don't round apart
+inline bool spheresOverlap( const vec3& p1, float64 radius1, const vec3& p2, float64 radius2 )
+{
+	float64 dx = static_cast< float64 >( p1.mX ) - p2.mX;
+	float64 dy = static_cast< float64 >( p1.mY ) - p2.mY;
+	float64 dz = static_cast< float64 >( p1.mZ ) - p2.mZ;
+	float64 r = radius1 + radius2;
+	return( dx * dx + dy * dy + dz * dz <= r * r );
+}
+
+// split policies
+// decide when a leaf divides into 8 children, and when 8 leaf children
+// can combine back (when none of them, nor all their items together,
+// would split). the tree keeps one policy and passes it to the voxels.
+// maxAlignedDistOut is isReducible()'s distance, 0 if not used
+
+// settings shared by all split policies
+// combining is given hysteresis so items moving back and forth over a
+// split don't free and reallocate the same children every frame
+class SplitPolicy
+{
+public:
+	
+	SplitPolicy( float64 minVoxelSize, int32 splitThreshold )
+	{
+		mMinVoxelSize = minVoxelSize;
+		mSplitThreshold = splitThreshold;
+		mMergeThreshold = 1;
+		mMinLifetime = 0;
+		mDeferCombine = false;
+	}
+	
+	// leaf children with this many items or fewer left between them
+	// are combined, once they are at least mMinLifetime ticks old
+	bool canCombine( int32 numItems, uint32 age ) const
+	{
+		return( numItems <= mMergeThreshold
+			&& age >= mMinLifetime );
+	}
+	
+	float64 mMinVoxelSize;
+	int32 mSplitThreshold;
+	
+	// keep below mSplitThreshold for hysteresis
+	int32 mMergeThreshold;
+	
+	// in octTree::tick() calls
+	uint32 mMinLifetime;
+	
+	// removes and moves never combine, only octTree::combine() does
+	bool mDeferCombine;
+};
+
+// split when items are far enough apart, see isReducible()
+// the threshold is not used
+class DistanceSplitPolicy : public SplitPolicy
+{
+public:
+	
+	DistanceSplitPolicy( float64 minVoxelSize, int32 splitThreshold ) :
+		SplitPolicy( minVoxelSize, splitThreshold )
+	{
+	}
+	
+	template< typename TItems >
+	bool shouldSplit( const TItems& items, float64 voxelSize, float64& maxAlignedDistOut ) const
+	{
+		return( isReducible( items, voxelSize, mMinVoxelSize, maxAlignedDistOut ));
+	}
+};
+
+// split when a leaf holds more than splitThreshold items
+// keeps buckets near a fixed size, whatever the item spacing
+class CapacitySplitPolicy : public SplitPolicy
+{
+public:
+	
+	CapacitySplitPolicy( float64 minVoxelSize, int32 splitThreshold ) :
+		SplitPolicy( minVoxelSize, splitThreshold )
+	{
+		errorCheck( splitThreshold >= 1 );
+	}
+	
+	template< typename TItems >
+	bool shouldSplit( const TItems& items, float64 voxelSize, float64& maxAlignedDistOut ) const
+	{
+		maxAlignedDistOut = 0;
+		return( items.size() > static_cast< size_t >( mSplitThreshold )
+			&& voxelSize > mMinVoxelSize );
+	}
+};
+
+// split when a leaf is over capacity and its items are far enough
+// apart for the split to separate them
+class HybridSplitPolicy : public SplitPolicy
+{
+public:
+	
+	HybridSplitPolicy( float64 minVoxelSize, int32 splitThreshold ) :
+		SplitPolicy( minVoxelSize, splitThreshold )
+	{
+		errorCheck( splitThreshold >= 1 );
+	}
+	
+	template< typename TItems >
+	bool shouldSplit( const TItems& items, float64 voxelSize, float64& maxAlignedDistOut ) const
+	{
+		maxAlignedDistOut = 0;
+		return( items.size() > static_cast< size_t >( mSplitThreshold )
+			&& isReducible( items, voxelSize, mMinVoxelSize, maxAlignedDistOut ));
+	}
+};
+
+template< typename T >
+class VoxelItem
+{
+public:
+	
+	// items are pooled, so T must be default constructible
+	VoxelItem()
+	{
+		mRadius = 0;
+	}
+	
+	VoxelItem( T item, const vec3& p, float64 radius )
+	{
+		reset( item, p, radius );
+	}
+	
+	// reinitialize a recycled item
+	void reset( T item, const vec3& p, float64 radius )
+	{
+		mItem = item;
+		mPos = p;
+		mRadius = radius;
+		mVelocity = kOrigin3;
+		mVoxels.clear();
+		mHandle = ItemHandle();
+	}
+	
+	T mItem;
+	ItemHandle mHandle;
+	vec3 mPos;
+	float64 mRadius;
+	
+	// movement over a step, see octTree::sweepSphere()
+	vec3 mVelocity;
+	std::vector< Voxel< T >* > mVoxels;
+};
+
+// leaf item storage
+// positions, radii and items are kept in separate contiguous arrays
+// so leaf scans stream through memory without dereferencing items
+// TItem needs mPos and mRadius
+template< typename TItem >
+class LeafBucket
+{
+public:
+	
+	static constexpr size_t kNotFound = static_cast< size_t >( -1 );
+	
+	size_t size() const
+	{
+		return( mItems.size() );
+	}
+	
+	void clear()
+	{
+		mX.clear();
+		mY.clear();
+		mZ.clear();
+		mRadius.clear();
+		mItems.clear();
+	}
+	
+	void reserve( size_t size )
+	{
+		mX.reserve( size );
+		mY.reserve( size );
+		mZ.reserve( size );
+		mRadius.reserve( size );
+		mItems.reserve( size );
+	}
+	
+	void add( TItem* item )
+	{
+		mX.push_back( item->mPos.mX );
+		mY.push_back( item->mPos.mY );
+		mZ.push_back( item->mPos.mZ );
+		mRadius.push_back( item->mRadius );
+		mItems.push_back( item );
+	}
+	
+	size_t find( const TItem* item ) const
+	{
+		for( size_t i=0; i<mItems.size(); ++i )
+		{
+			if (mItems[ i ] == item)
+			{
+				return( i );
+			}
+		}
+		
+		return( kNotFound );
+	}
+	
+	// copy an item's new position and radius into its entry
+	bool update( const TItem* item )
+	{
+		size_t index = find( item );
+		if (index == kNotFound)
+		{
+			return( false );
+		}
+		
+		mX[ index ] = item->mPos.mX;
+		mY[ index ] = item->mPos.mY;
+		mZ[ index ] = item->mPos.mZ;
+		mRadius[ index ] = item->mRadius;
+		return( true );
+	}
+	
+	// order is not kept, last entry is moved into the hole
+	bool remove( const TItem* item )
+	{
+		size_t index = find( item );
+		if (index == kNotFound)
+		{
+			return( false );
+		}
+		
+		size_t last = mItems.size() - 1;
+		mX[ index ] = mX[ last ];
+		mY[ index ] = mY[ last ];
+		mZ[ index ] = mZ[ last ];
+		mRadius[ index ] = mRadius[ last ];
+		mItems[ index ] = mItems[ last ];
+		
+		mX.pop_back();
+		mY.pop_back();
+		mZ.pop_back();
+		mRadius.pop_back();
+		mItems.pop_back();
+		return( true );
+	}
+	
+	vec3 getPos( size_t index ) const
+	{
+		return( vec3( mX[ index ], mY[ index ], mZ[ index ] ));
+	}
+	
+	// item box (see Box3( center, radius )) intersects bounds
+	// done in float32 to match Box3
+	bool intersects( size_t index, const vec3& boundsMin, const vec3& boundsMax ) const
+	{
+		float32 r = static_cast< float32 >( mRadius[ index ] );
+		return( mX[ index ] - r <= boundsMax.mX
+			&& mY[ index ] - r <= boundsMax.mY
+			&& mZ[ index ] - r <= boundsMax.mZ
+			&& mX[ index ] + r >= boundsMin.mX
+			&& mY[ index ] + r >= boundsMin.mY
+			&& mZ[ index ] + r >= boundsMin.mZ );
+	}
+	
+	// f( i ) for each item intersecting bounds, in blocks of 8 with getBoxHits()
+	// f returns false to stop
+	template< typename F >
+	bool forEachHit( const vec3& boundsMin, const vec3& boundsMax, F&& f ) const
+	{
+		for( size_t first=0; first<mItems.size(); first+=8 )
+		{
+			size_t count = std::min< size_t >( 8, mItems.size() - first );
+			uint32 mask = getBoxHits( &mX[ first ], &mY[ first ], &mZ[ first ], &mRadius[ first ],
+				count, boundsMin, boundsMax );
+			for( size_t i=0; mask != 0; ++i, mask >>= 1 )
+			{
+				if ((mask & 1) && f( first + i ) == false)
+				{
+					return( false );
+				}
+			}
+		}
+		
+		return( true );
+	}
+	
+	// f( i, t ) for each item a beam hits, v = p2 - p1
+	// t is getCollision()'s, blocks of 8 go through getBeamHits()
+	template< typename F >
+	bool forEachHit( const vec3& p1, const vec3& v, float64 radius, F&& f ) const
+	{
+		float64 ts[ 8 ];
+		for( size_t first=0; first<mItems.size(); first+=8 )
+		{
+			size_t count = std::min< size_t >( 8, mItems.size() - first );
+			uint32 mask = getBeamHits( &mX[ first ], &mY[ first ], &mZ[ first ], &mRadius[ first ],
+				count, p1, v, radius, ts );
+			for( size_t i=0; mask != 0; ++i, mask >>= 1 )
+			{
+				if ((mask & 1) && f( first + i, ts[ i ] ) == false)
+				{
+					return( false );
+				}
+			}
+		}
+		
+		return( true );
+	}
+	
+	typename std::vector< TItem* >::const_iterator begin() const
+	{
+		return( mItems.begin() );
+	}
+	
+	typename std::vector< TItem* >::const_iterator end() const
+	{
+		return( mItems.end() );
+	}
+	
+	std::vector< float32 > mX;
+	std::vector< float32 > mY;
+	std::vector< float32 > mZ;
+	std::vector< float64 > mRadius;
+	std::vector< TItem* > mItems;
+};
+
+template< typename T >
+class Voxel
+{
+public:
+	
+	Voxel()
+	{
+		mParent = nullptr;
+		mChildren = nullptr;
+		mNumItems = 0;
+	}
+	
+	Voxel( Voxel* parent, const Box3& bounds ) : Voxel()
+	{
+		reset( parent, bounds );
+	}
+	
+	// reinitialize a recycled voxel
+	// children are owned by the arena, not the voxel
+	void reset( Voxel* parent, const Box3& bounds )
+	{
+		mParent = parent;
+		mBounds = bounds;
+		mNumItems = 0;
+		mItems.clear();
+		mChildren = nullptr;
+	}
+	
+	bool isLeaf() const
+	{
+		return( mChildren == nullptr );
+	}
+	
+	// not divisible add
+    // for leafs only
+	void add( VoxelItem<T>* item )
+	{
+        errorCheck( isLeaf() );
+		errorCheck( mItems.find( item ) == LeafBucket< VoxelItem<T> >::kNotFound );
+		mItems.add( item );
+		item->mVoxels.push_back( this );
+	}
+	
+	template< typename TPolicy >
+	void add( VoxelItem<T>* item, const Box3& bounds, const TPolicy& policy, NodeArena<T>& arena )
+	{
+        if (mBounds.intersects( bounds ) == false)
+        {
+            // not added to this voxel
+        }
+        else
+        {
+            mNumItems++;
+            if (isLeaf())
+            {
+                // root case - no children
+                add( item );
+                divide( policy, arena );
+            }
+            else
+            {
+                // add to children
+                for( Voxel<T>& child : mChildren->mVoxels )
+                {
+					child.add( item, bounds, policy, arena );
+				}
+			}
+		}
+	}
+	
+    // for leafs only
+	void remove( VoxelItem<T>* item )
+	{
+        //errorCheck( isLeaf() );
+		auto iter = std::find( item->mVoxels.begin(), item->mVoxels.end(), this );
+		errorCheck( iter != item->mVoxels.end() );
+		item->mVoxels.erase( iter );
+		bool removed = this->mItems.remove( item );
+		errorCheck( removed );
+        
+        // voxels items must match
+        //errorCheck( mNumItems == mItems.size() );
+	}
+	
+    // todo: trivial collapse: only collapse voxels when ir has only 1 or 0 items.
+	template< typename TPolicy >
+	void remove( VoxelItem<T>* item, const Box3& bounds, const TPolicy& policy, bool combineVoxels,
+		NodeArena<T>& arena )
+	{
+		// parents only recurse into children touching bounds
+        errorCheck( mNumItems > 0 );
+        --mNumItems;
+        
+		if (isLeaf() == false)
+		{
+			uint32 mask = getChildMask( bounds );
+			for( int32 c=0; c<8; ++c )
+			{
+				if (mask & (1 << c))
+				{
+					mChildren->mVoxels[ c ].remove( item, bounds, policy, combineVoxels, arena );
+				}
+			}
+		}
+		
+		if (isLeaf())
+		{
+			// item must be attached to this leaf voxel
+			bool removed = mItems.remove( item );
+			errorCheck( removed );
+			
+			auto iter2 = std::find( item->mVoxels.begin(),
+				item->mVoxels.end(), this );
+			errorCheck( iter2 != item->mVoxels.end() );
+			item->mVoxels.erase( iter2 );
+		}
+		 
+        // do trival combines
+        if (combineVoxels
+            && policy.mDeferCombine == false)
+        {
+            combineFew( policy, arena );
+        }
+        
+        return;
+        
+//        // look to see if children need to be combined
+//        // temp skip the recombine
+//        if (combineVoxels == false)
+//        {
+//            return;
+//        }
+//
+//        if (mChildren.size() > 0)
+//        {
+//            // see if all children are eligible for combine
+//            // must be leafs
+//            bool combine = true;
+//            std::set< VoxelItem<T>* > items;
+//            float64 maxDist;
+//
+//            // first check if all children are leafs
+//            for( Voxel<T>* child : mChildren)
+//            {
+//                if (child->mChildren.size() > 0)
+//                {
+//                    combine = false;
+//                    break;
+//                }
+//            }
+//
+//            // next check if dist is great enoug between furtherest objects
+//            if (combine)
+//            {
+//                for( Voxel<T>* child : mChildren)
+//                {
+//                    if (child->isReducible( child->mItems, child->getVoxelSize(), minVoxelSize, maxDist ) == false)
+//                    {
+//                        // don't change
+//                        for( VoxelItem<T>* item : child->mItems )
+//                        {
+//                            items.insert( item );
+//                        }
+//                    }
+//                    else
+//                    {
+//                        combine = false;
+//                        break;
+//                    }
+//                }
+//            }
+//
+//            if (combine
+//                && isReducible( items, getVoxelSize(), minVoxelSize, maxDist ) == false)
+//            {
+//                // combine all childen
+//                for( Voxel<T>* child : mChildren )
+//                {
+//                    // must be leaf
+//                    errorCheck( child->mChildren.size() == 0 );
+//
+//                    for( ; child->mItems.size() > 0; )
+//                    {
+//                        VoxelItem<T>* item = *(child->mItems.begin());
+//                        child->remove( item );
+//                    }
+//
+//                    delete child;
+//                }
+//
+//                mChildren.clear();
+//
+//                errorCheck( mItems.size() == 0 );
+//                for( VoxelItem<T>* item : items )
+//                {
+//                    add( item );
+//                }
+//            }
+//        }
+	}
+
+	// combine leaf children back into this voxel when few items are left
+	// see SplitPolicy::canCombine(). children that are not leafs
+	// couldn't combine themselves, so this voxel stays split too
+	template< typename TPolicy >
+	void combineFew( const TPolicy& policy, NodeArena<T>& arena )
+	{
+		if (isLeaf()
+			|| policy.canCombine( mNumItems, arena.getAge( mChildren )) == false)
+		{
+			return;
+		}
+		
+		for( Voxel<T>& child : mChildren->mVoxels )
+		{
+			if (child.isLeaf() == false)
+			{
+				return;
+			}
+		}
+		
+		// items can be in several children
+		for( Voxel<T>& child : mChildren->mVoxels )
+		{
+			for( VoxelItem<T>* item : child.mItems )
+			{
+				if (mItems.find( item ) == LeafBucket< VoxelItem<T> >::kNotFound)
+				{
+					mItems.add( item );
+				}
+			}
+		}
+		
+		for( Voxel<T>& child : mChildren->mVoxels )
+		{
+			for( ; child.mItems.size() > 0; )
+			{
+				child.remove( *(child.mItems.begin()) );
+			}
+		}
+		
+		arena.freeBlock( mChildren );
+		mChildren = nullptr;
+		
+		errorCheck( static_cast< int32 >( mItems.size() ) == mNumItems );
+		for( VoxelItem<T>* item : mItems )
+		{
+			item->mVoxels.push_back( this );
+		}
+	}
+	
+	// move an item from oldBox to newBox in this voxel
+	// voxels in both keep the item as it is, voxels only in one get a
+	// normal remove() or add(), so splits and combines only happen where
+	// the item really came or went. item must already have its new position
+	template< typename TPolicy >
+	void move( VoxelItem<T>* item, const Box3& oldBox, const Box3& newBox, const TPolicy& policy,
+		NodeArena<T>& arena )
+	{
+		bool inOld = mBounds.intersects( oldBox );
+		bool inNew = mBounds.intersects( newBox );
+		if (inOld && inNew)
+		{
+			// item count doesn't change
+			if (isLeaf())
+			{
+				bool updated = mItems.update( item );
+				errorCheck( updated );
+			}
+			else
+			{
+				for( Voxel<T>& child : mChildren->mVoxels )
+				{
+					child.move( item, oldBox, newBox, policy, arena );
+				}
+			}
+		}
+		else if (inOld)
+		{
+			remove( item, oldBox, policy, true, arena );
+		}
+		else if (inNew)
+		{
+			add( item, newBox, policy, arena );
+		}
+	}
+	
+	// batch version of move()
+	// moves[ list[ first, last ) ] are the moves touching this voxel with
+	// their old or new box. the moves are applied to the children first,
+	// then this voxel splits or combines once for all of them.
+	// child lists are pushed on the end of list and popped after use.
+	// masks is scratch space, used up before recursing
+	template< typename TPolicy >
+	void moveMany( const std::vector< ItemMove<T> >& moves, std::vector< uint32 >& list,
+		size_t first, size_t last, std::vector< uint8 >& masks, const TPolicy& policy,
+		NodeArena<T>& arena )
+	{
+		if (isLeaf())
+		{
+			bool added = false;
+			for( size_t i=first; i<last; ++i )
+			{
+				const ItemMove<T>& move = moves[ list[ i ] ];
+				bool inOld = mBounds.intersects( move.mOldBox );
+				bool inNew = mBounds.intersects( move.mNewBox );
+				if (inOld && inNew)
+				{
+					bool updated = mItems.update( move.mItem );
+					errorCheck( updated );
+				}
+				else if (inOld)
+				{
+					errorCheck( mNumItems > 0 );
+					--mNumItems;
+					remove( move.mItem );
+				}
+				else
+				{
+					++mNumItems;
+					add( move.mItem );
+					added = true;
+				}
+			}
+			
+			if (added)
+			{
+				divide( policy, arena );
+			}
+			
+			return;
+		}
+		
+		// children touched by each move, and their list sizes
+		size_t childCounts[ 8 ] = { 0 };
+		masks.resize( last - first );
+		for( size_t i=first; i<last; ++i )
+		{
+			const ItemMove<T>& move = moves[ list[ i ] ];
+			mNumItems += (mBounds.intersects( move.mNewBox ) ? 1 : 0)
+				- (mBounds.intersects( move.mOldBox ) ? 1 : 0);
+			
+			uint32 mask = getChildMask( move.mOldBox ) | getChildMask( move.mNewBox );
+			for( int32 c=0; c<8; ++c )
+			{
+				if (mask & (1 << c))
+				{
+					childCounts[ c ]++;
+				}
+			}
+			
+			masks[ i - first ] = static_cast< uint8 >( mask );
+		}
+		
+		errorCheck( mNumItems >= 0 );
+		
+		size_t listsEnd = list.size();
+		size_t childFirsts[ 8 ];
+		size_t childNext[ 8 ];
+		size_t listSize = listsEnd;
+		for( int32 c=0; c<8; ++c )
+		{
+			childFirsts[ c ] = listSize;
+			childNext[ c ] = listSize;
+			listSize += childCounts[ c ];
+		}
+		
+		list.resize( listSize );
+		for( size_t i=first; i<last; ++i )
+		{
+			uint32 mask = masks[ i - first ];
+			for( int32 c=0; c<8; ++c )
+			{
+				if (mask & (1 << c))
+				{
+					list[ childNext[ c ]++ ] = list[ i ];
+				}
+			}
+		}
+		
+		for( int32 c=0; c<8; ++c )
+		{
+			if (childCounts[ c ] > 0)
+			{
+				mChildren->mVoxels[ c ].moveMany( moves, list, childFirsts[ c ],
+					childFirsts[ c ] + childCounts[ c ], masks, policy, arena );
+				
+				// pop anything the child pushed
+				list.resize( listSize );
+			}
+		}
+		
+		list.resize( listsEnd );
+		if (policy.mDeferCombine == false)
+		{
+			combineFew( policy, arena );
+		}
+	}
+	
+	// check for combining a space of voxels
+	template< typename TPolicy >
+	void combine( const Box3& bounds, const TPolicy& policy, NodeArena<T>& arena )
+	{
+		if (mBounds.intersects( bounds ) == false)
+		{
+			// item can't be in this voxel
+			return;
+		}
+		
+		if (isLeaf() == false)
+		{
+			for( Voxel<T>& child : mChildren->mVoxels )
+			{
+				child.combine( bounds, policy, arena );
+			}
+		}
+		
+		// few items left, deferred from remove()
+		combineFew( policy, arena );
+		
+		if (isLeaf() == false
+			&& arena.getAge( mChildren ) >= policy.mMinLifetime)
+		{
+			// see if all children are eligible for combine
+			// must be leafs
+			bool combine = true;
+			std::set< VoxelItem<T>* > items;
 			float64 maxDist;
 			
-			// first check if all children are leafs
-			for( Voxel<T>* child : mChildren)
+			// first check if all children are leafs
+			for( Voxel<T>& child : mChildren->mVoxels )
+			{
+				if (child.isLeaf() == false)
+				{
+					combine = false;
+					break;
+				}
+			}
+			
+			// next check if dist is great enoug between furtherest objects
+			if (combine)
+			{
+				for( Voxel<T>& child : mChildren->mVoxels )
+				{
+					if (policy.shouldSplit( child.mItems, child.getVoxelSize(), maxDist ) == false)
+					{
+						for( VoxelItem<T>* item : child.mItems )
+						{
+							items.insert( item );
+						}
+					}
+					else
+					{
+						// don't change
+						combine = false;
+						break;
+					}
+				}
+			}
+			
+			if (combine
+				&& policy.shouldSplit( items, getVoxelSize(), maxDist ) == false)
+			{
+				// combine all childen
+				for( Voxel<T>& child : mChildren->mVoxels )
+				{
+					// must be leaf
+					errorCheck( child.isLeaf() );
+					
+					for( ; child.mItems.size() > 0; )
+					{
+						VoxelItem<T>* item = *(child.mItems.begin());
+						child.remove( item );
+					}
+				}
+				
+				arena.freeBlock( mChildren );
+				mChildren = nullptr;
+				
+				errorCheck( mItems.size() == 0 );
+				for( VoxelItem<T>* item : items )
+				{
+					add( item );
+				}
+			}
+		}
+	}
+	
+	float64 getVoxelSize() const
+	{
+		return( mBounds.getSize().mX );
+	}
+	
+	template< typename TPolicy >
+	void divide( const TPolicy& policy, NodeArena<T>& arena )
+	{
+		// must not have been divided already
+		errorCheck( isLeaf() );
+		
+		float64 maxAlignedDist;
+		bool reduce = policy.shouldSplit( this->mItems, getVoxelSize(), maxAlignedDist );
+		if (reduce == false)
+		{
+			return;
+		}
+		
+		// all 8 children are allocated together
+		mChildren = arena.allocBlock( this );
+		
+		// migrate items to children
+		for( VoxelItem<T>* item : mItems )
+		{
+			for( Voxel< T >& child : mChildren->mVoxels )
+			{
+				float64 radius = item->mRadius;
+				Box3 box( item->mPos, radius );
+				if (child.mBounds.intersects( box ))
+				{
+                    child.mNumItems++;
+					child.add( item );
+				}
+			}
+		}
+		
+		// check if a reduction was made
+		int32 maxNumber = 0;
+		
+		for( Voxel< T >& child : mChildren->mVoxels )
+		{
+			int32 childNumItems = child.mItems.size();
+			if (childNumItems > maxNumber)
+			{
+				maxNumber = childNumItems;
+			}
+		}
+		
+		float64 childVoxelSize = getVoxelSize() / 2 ;
+		if (maxAlignedDist > childVoxelSize)
+		{
+			// must have been reduced
+			errorCheck( maxNumber < static_cast< int64 >( mItems.size() ) );
+		}
+		
+		// migrate items from parent to children
+		errorCheck( mItems.size() > 0 );
+		
+		for( ; mItems.size() > 0; )
+		{
+			VoxelItem<T>* item = *(mItems.begin());
+			this->remove( item );
+		}
+		
+		// look to subdivide further
+		for( Voxel<T>& child : mChildren->mVoxels )
+		{
+			child.divide( policy, arena );
+		}
+	}
+	
+	// bulk build of an empty leaf
+	// items[ first, last ) are the items intersecting this voxel.
+	// children are created once and items go straight to their final leafs.
+	// child lists are pushed on the end of items and popped after use.
+	// masks is scratch space, used up before recursing
+	template< typename TPolicy >
+	void build( std::vector< VoxelItem<T>* >& items, size_t first, size_t last,
+		std::vector< uint8 >& masks, const TPolicy& policy, NodeArena<T>& arena,
+		std::mutex* arenaLock = nullptr, bool linkItems = true )
+	{
+		size_t childFirsts[ 8 ];
+		size_t childCounts[ 8 ];
+		if (buildNode( items, first, last, masks, policy, arena, arenaLock, linkItems,
+			childFirsts, childCounts ) == false)
+		{
+			return;
+		}
+		
+		size_t listsEnd = items.size();
+		for( int32 c=0; c<8; ++c )
+		{
+			mChildren->mVoxels[ c ].build( items, childFirsts[ c ], childFirsts[ c ] + childCounts[ c ],
+				masks, policy, arena, arenaLock, linkItems );
+			
+			// pop anything the child pushed
+			items.resize( listsEnd );
+		}
+		
+		items.resize( childFirsts[ 0 ] );
+	}
+	
+	// parallel version of build()
+	// children with at least minTaskItems items are built as tasks in group.
+	// arena allocations go through arenaLock and items are not linked
+	// to their voxels, see linkItems()
+	template< typename TPolicy >
+	void buildParallel( std::vector< VoxelItem<T>* >& items, const TPolicy& policy, NodeArena<T>& arena,
+		std::mutex& arenaLock, ThreadPool& pool, TaskGroup& group, size_t minTaskItems )
+	{
+		std::vector< uint8 > masks;
+		size_t childFirsts[ 8 ];
+		size_t childCounts[ 8 ];
+		if (buildNode( items, 0, items.size(), masks, policy, arena, &arenaLock, false,
+			childFirsts, childCounts ) == false)
+		{
+			return;
+		}
+		
+		size_t listsEnd = items.size();
+		for( int32 c=0; c<8; ++c )
+		{
+			Voxel<T>* child = &mChildren->mVoxels[ c ];
+			if (childCounts[ c ] >= minTaskItems)
+			{
+				// task gets its own copy of the child list
+				auto first = items.begin() + childFirsts[ c ];
+				std::shared_ptr< std::vector< VoxelItem<T>* > > childItems(
+					new std::vector< VoxelItem<T>* >( first, first + childCounts[ c ] ));
+				
+				pool.run( [=, &policy, &arena, &arenaLock, &pool, &group]()
+				{
+					child->buildParallel( *childItems, policy, arena, arenaLock, pool, group, minTaskItems );
+				}, group );
+			}
+			else
+			{
+				child->build( items, childFirsts[ c ], childFirsts[ c ] + childCounts[ c ],
+					masks, policy, arena, &arenaLock, false );
+				items.resize( listsEnd );
+			}
+		}
+	}
+	
+	// add leafs to their items' voxel lists after a parallel build
+	// same depth first order as build(), so the lists come out the same
+	void linkItems()
+	{
+		if (isLeaf())
+		{
+			for( VoxelItem<T>* item : mItems )
+			{
+				item->mVoxels.push_back( this );
+			}
+		}
+		else
+		{
+			for( Voxel<T>& child : mChildren->mVoxels )
+			{
+				child.linkItems();
+			}
+		}
+	}
+	
+	// bit c is set if mChildren->mVoxels[ c ] intersects box
+	// child bounds only take 2 values per axis (see split8)
+	// so the children are found one axis at a time.
+	// same result as child.mBounds.intersects( box )
+	uint32 getChildMask( const Box3& box ) const
+	{
+		return( ::getChildMask( mChildren->mVoxels[ 0 ].mBounds, mChildren->mVoxels[ 7 ].mBounds, box ));
+	}
+	
+	// bit c is set if the beam enters mChildren->mVoxels[ c ]
+	uint32 getChildMask( const vec3& p1, const vec3& p2, float64 radius ) const
+	{
+		return( ::getChildMask( mChildren->mVoxels[ 0 ].mBounds, mChildren->mVoxels[ 7 ].mBounds,
+			p1, p2, radius ));
+	}
+	
+	// decide if a building voxel splits
+	// leafs get their items. otherwise children are allocated and the
+	// 8 child lists are laid out after the end of items
+	template< typename TPolicy >
+	bool buildNode( std::vector< VoxelItem<T>* >& items, size_t first, size_t last,
+		std::vector< uint8 >& masks, const TPolicy& policy, NodeArena<T>& arena,
+		std::mutex* arenaLock, bool linkItems, size_t* childFirsts, size_t* childCounts )
+	{
+		errorCheck( isLeaf() && mItems.size() == 0 );
+		mNumItems = static_cast< int32 >( last - first );
+		
+		float64 maxAlignedDist;
+		ItemSpan< VoxelItem<T> > span( items.data() + first, items.data() + last );
+		if (policy.shouldSplit( span, getVoxelSize(), maxAlignedDist ) == false)
+		{
+			mItems.reserve( last - first );
+			for( size_t i=first; i<last; ++i )
+			{
+				// unique by construction, no need for add()'s check
+				VoxelItem<T>* item = items[ i ];
+				mItems.add( item );
+				if (linkItems)
+				{
+					item->mVoxels.push_back( this );
+				}
+			}
+			
+			return( false );
+		}
+		
+		if (arenaLock != nullptr)
+		{
+			std::lock_guard< std::mutex > lock( *arenaLock );
+			mChildren = arena.allocBlock( this );
+		}
+		else
+		{
+			mChildren = arena.allocBlock( this );
+		}
+		
+		std::fill( childCounts, childCounts + 8, 0 );
+		masks.resize( last - first );
+		for( size_t i=first; i<last; ++i )
+		{
+			uint32 mask = getChildMask( Box3( items[ i ]->mPos, items[ i ]->mRadius ));
+			for( int32 c=0; c<8; ++c )
+			{
+				if (mask & (1 << c))
+				{
+					childCounts[ c ]++;
+				}
+			}
+			
+			masks[ i - first ] = static_cast< uint8 >( mask );
+		}
+		
+		size_t end = items.size();
+		for( int32 c=0; c<8; ++c )
+		{
+			childFirsts[ c ] = end;
+			end += childCounts[ c ];
+		}
+		
+		items.resize( end );
+		
+		size_t childNext[ 8 ];
+		std::copy( childFirsts, childFirsts + 8, childNext );
+		for( size_t i=first; i<last; ++i )
+		{
+			uint32 mask = masks[ i - first ];
+			for( int32 c=0; c<8; ++c )
+			{
+				if (mask & (1 << c))
+				{
+					items[ childNext[ c ]++ ] = items[ i ];
+				}
+			}
+		}
+		
+		return( true );
+	}
+	
+	// calls f( item ) for items intersecting bounds
+	// items already in mailbox are skipped. this voxel must touch bounds,
+	// children are culled 8 at a time with getChildMask().
+	// returns false if f returned false to stop the query
+	template< typename F >
+	bool forEachItem( const Box3& bounds, const vec3& boundsMin, const vec3& boundsMax,
+		QueryMailbox& mailbox, F& f ) const
+	{
+		if (isLeaf())
+		{
+			// the box test is cheaper than the mailbox lookup, so it goes first
+			return( mItems.forEachHit( boundsMin, boundsMax, [&]( size_t i )
+			{
+				const VoxelItem<T>* item = mItems.mItems[ i ];
+				return( mailbox.mark( item->mHandle.mIndex ) == false || f( item->mItem ));
+			} ));
+		}
+		else
+		{
+			// tree node
+			// if children, all items should be in children
+			errorCheck( mItems.size() == 0 );
+			uint32 mask = getChildMask( bounds );
+			for( int32 c=0; c<8; ++c )
+			{
+				if ((mask & (1 << c))
+					&& mChildren->mVoxels[ c ].forEachItem( bounds, boundsMin, boundsMax, mailbox, f ) == false)
+				{
+					return( false );
+				}
+			}
+		}
+		
+		return( true );
+	}
+	
+	// beam version of forEachItem(), v = p2 - p1
+	// the beam must enter this voxel (Box3::getRayEntry())
+	template< typename F >
+	bool forEachItem( const vec3& p1, const vec3& p2, const vec3& v, float64 radius,
+		QueryMailbox& mailbox, F& f ) const
+	{
+		if (isLeaf())
+		{
+			// only hits are marked, an item missed here misses everywhere
+			return( mItems.forEachHit( p1, v, radius, [&]( size_t i, float64 )
+			{
+				const VoxelItem<T>* item = mItems.mItems[ i ];
+				return( mailbox.mark( item->mHandle.mIndex ) == false || f( item->mItem ));
+			} ));
+		}
+		else
+		{
+			// tree node - recurse
+			uint32 mask = getChildMask( p1, p2, radius );
+			for( int32 c=0; c<8; ++c )
+			{
+				if ((mask & (1 << c))
+					&& mChildren->mVoxels[ c ].forEachItem( p1, p2, v, radius, mailbox, f ) == false)
+				{
+					return( false );
+				}
+			}
+		}
+		
+		return( true );
+	}
+
+	// packet version of the beam forEachItem(), calls f( ray, item )
+	// bit i of rayMask is set for rays that enter this voxel. a child
+	// gets the rays that enter it, so the packet only thins out where
+	// its rays go separate ways
+	template< typename F >
+	bool forEachItem( const RayPacket& packet, uint32 rayMask, PacketMailbox& mailbox, F& f ) const
+	{
+		if (isLeaf())
+		{
+			for( int32 ray=0; ray<packet.mNumRays; ++ray )
+			{
+				if ((rayMask & (1 << ray)) == 0)
+				{
+					continue;
+				}
+				
+				if (mItems.forEachHit( packet.mP1[ ray ], packet.mV[ ray ], packet.mRadius[ ray ], [&]( size_t i, float64 )
+				{
+					const VoxelItem<T>* item = mItems.mItems[ i ];
+					return( mailbox.mark( item->mHandle.mIndex, ray ) == false || f( ray, item->mItem ));
+				} ) == false)
+				{
+					return( false );
+				}
+			}
+			
+			return( true );
+		}
+		
+		uint32 childRays[ 8 ];
+		getChildRays( mChildren->mVoxels[ 0 ].mBounds, mChildren->mVoxels[ 7 ].mBounds,
+			packet.mP1, packet.mP2, packet.mRadius, packet.mNumRays, rayMask, childRays );
+		
+		for( int32 c=0; c<8; ++c )
+		{
+			if (childRays[ c ] != 0
+				&& mChildren->mVoxels[ c ].forEachItem( packet, childRays[ c ], mailbox, f ) == false)
+			{
+				return( false );
+			}
+		}
+		
+		return( true );
+	}
+	
+	// box queries of getItemsBatch()
+	// the boxes of list[ first, last ) touch this voxel. child lists are
+	// laid out after the end of list, as in build(). no mailbox is used,
+	// a leaf only reports an item if it holds the min corner of the
+	// overlap of item and query box (see forEachLeafPair()), so every
+	// item is found once per query. hits are ( query, item ) pairs
+	void getItemsBatch( const std::vector< Box3 >& boxes, std::vector< uint32 >& list,
+		size_t first, size_t last, const vec3& rootMax, std::vector< std::pair< uint32, T > >& hits ) const
+	{
+		if (isLeaf())
+		{
+			vec3 leafMin = mBounds.getMin();
+			vec3 leafMax = mBounds.getMax();
+			for( size_t i=first; i<last; ++i )
+			{
+				uint32 query = list[ i ];
+				vec3 boxMin = boxes[ query ].getMin();
+				vec3 boxMax = boxes[ query ].getMax();
+				mItems.forEachHit( boxMin, boxMax, [&]( size_t j )
+				{
+					vec3 p = mItems.getPos( j );
+					float32 r = static_cast< float32 >( mItems.mRadius[ j ] );
+					for( int32 axis=0; axis<3; ++axis )
+					{
+						float32 overlapMin = std::max( p[ axis ] - r, boxMin[ axis ] );
+						if (overlapMin < leafMin[ axis ]
+							|| (overlapMin >= leafMax[ axis ] && leafMax[ axis ] != rootMax[ axis ]))
+						{
+							return( true );
+						}
+					}
+					
+					hits.push_back( std::make_pair( query, mItems.mItems[ j ]->mItem ));
+					return( true );
+				} );
+			}
+			
+			return;
+		}
+		
+		size_t childCounts[ 8 ] = { 0 };
+		for( size_t i=first; i<last; ++i )
+		{
+			uint32 mask = getChildMask( boxes[ list[ i ] ] );
+			for( int32 c=0; c<8; ++c )
+			{
+				childCounts[ c ] += (mask >> c) & 1;
+			}
+		}
+		
+		size_t listsEnd = list.size();
+		size_t childFirsts[ 8 ];
+		size_t childNext[ 8 ];
+		size_t listSize = listsEnd;
+		for( int32 c=0; c<8; ++c )
+		{
+			childFirsts[ c ] = listSize;
+			childNext[ c ] = listSize;
+			listSize += childCounts[ c ];
+		}
+		
+		list.resize( listSize );
+		for( size_t i=first; i<last; ++i )
+		{
+			uint32 mask = getChildMask( boxes[ list[ i ] ] );
+			for( int32 c=0; c<8; ++c )
+			{
+				if (mask & (1 << c))
+				{
+					list[ childNext[ c ]++ ] = list[ i ];
+				}
+			}
+		}
+		
+		for( int32 c=0; c<8; ++c )
+		{
+			if (childCounts[ c ] > 0 && mChildren->mVoxels[ c ].mNumItems > 0)
+			{
+				mChildren->mVoxels[ c ].getItemsBatch( boxes, list, childFirsts[ c ],
+					childFirsts[ c ] + childCounts[ c ], rootMax, hits );
+			}
+		}
+		
+		list.resize( listsEnd );
+	}
+	
+	// f( item ) for every item in leafs the beam touches, no item tests
+	// slab tested, so a beam of length 0 works. the beam must enter
+	// this voxel
+	template< typename F >
+	void forEachBeamItem( const vec3& p1, const vec3& p2, float64 radius,
+		QueryMailbox& mailbox, F& f ) const
+	{
+		if (isLeaf())
+		{
+			for( const VoxelItem<T>* item : mItems )
+			{
+				if (mailbox.mark( item->mHandle.mIndex ))
+				{
+					f( item );
+				}
+			}
+		}
+		else
+		{
+			uint32 mask = getChildMask( p1, p2, radius );
+			for( int32 c=0; c<8; ++c )
+			{
+				if (mask & (1 << c))
+				{
+					mChildren->mVoxels[ c ].forEachBeamItem( p1, p2, radius, mailbox, f );
+				}
+			}
+		}
+	}
+	
+	// polytope version of forEachItem()
+	// bit i of planeMask is set while planes[ i ] still cuts the voxel.
+	// planes a voxel is fully inside are not tested again below it
+	template< typename F >
+	bool forEachItem( const Plane* planes, int32 numPlanes, uint32 planeMask,
+		QueryMailbox& mailbox, F& f ) const
+	{
+		for( int32 i=0; i<numPlanes; ++i )
+		{
+			if (planeMask & (1u << i))
+			{
+				int32 side = mBounds.classify( planes[ i ] );
+				if (side < 0)
+				{
+					// outside this plane, so outside the polytope
+					return( true );
+				}
+				
+				if (side > 0)
+				{
+					planeMask &= ~(1u << i);
+				}
+			}
+		}
+		
+		if (planeMask == 0)
+		{
+			// fully inside, every item intersects
+			return( forEachItem( mailbox, f ));
+		}
+		
+		if (isLeaf())
+		{
+			for( size_t i=0; i<mItems.size(); ++i )
+			{
+				const VoxelItem<T>* item = mItems.mItems[ i ];
+				if (mailbox.isMarked( item->mHandle.mIndex ))
+				{
+					continue;
+				}
+				
+				// item sphere against the planes that cut this voxel
+				// only marked once found, another leaf may still find it
+				bool inside = true;
+				for( int32 j=0; j<numPlanes && inside; ++j )
+				{
+					if ((planeMask & (1u << j))
+						&& planes[ j ].dist( item->mPos ) < -item->mRadius)
+					{
+						inside = false;
+					}
+				}
+				
+				if (inside)
+				{
+					mailbox.mark( item->mHandle.mIndex );
+					if (f( item->mItem ) == false)
+					{
+						return( false );
+					}
+				}
+			}
+		}
+		else
+		{
+			for( Voxel<T>& child : mChildren->mVoxels )
+			{
+				if (child.forEachItem( planes, numPlanes, planeMask, mailbox, f ) == false)
+				{
+					return( false );
+				}
+			}
+		}
+		
+		return( true );
+	}
+	
+	// closest beam hit in this voxel, v = p2 - p1
+	// children are visited in the order the beam enters them, and any
+	// that start after the best hit so far are skipped
+	void raycastFirst( const vec3& p1, const vec3& p2, const vec3& v, float64 radius,
+		QueryMailbox& mailbox, const VoxelItem<T>*& bestItem, float64& bestT ) const
+	{
+		if (isLeaf())
+		{
+			mItems.forEachHit( p1, v, radius, [&]( size_t i, float64 t )
+			{
+				const VoxelItem<T>* item = mItems.mItems[ i ];
+				if (mailbox.mark( item->mHandle.mIndex ) && (bestItem == nullptr || t < bestT))
+				{
+					bestItem = item;
+					bestT = t;
+				}
+				
+				return( true );
+			} );
+			
+			return;
+		}
+		
+		// sort hit children by entry, at most 8 so insertion sort
+		float64 childTs[ 8 ];
+		int32 order[ 8 ];
+		int32 numHit = 0;
+		for( int32 c=0; c<8; ++c )
+		{
+			float64 t = mChildren->mVoxels[ c ].mBounds.getRayEntry( p1, p2, radius );
+			if (t >= 0)
+			{
+				int32 j = numHit++;
+				while( j > 0 && childTs[ j - 1 ] > t )
+				{
+					childTs[ j ] = childTs[ j - 1 ];
+					order[ j ] = order[ j - 1 ];
+					--j;
+				}
+				
+				childTs[ j ] = t;
+				order[ j ] = c;
+			}
+		}
+		
+		for( int32 i=0; i<numHit; ++i )
+		{
+			if (bestItem != nullptr && childTs[ i ] > bestT)
+			{
+				// the rest start further along than the best hit
+				break;
+			}
+			
+			mChildren->mVoxels[ order[ i ] ].raycastFirst( p1, p2, v, radius, mailbox, bestItem, bestT );
+		}
+	}
+	
+	// every item in this voxel, no tests
+	template< typename F >
+	bool forEachItem( QueryMailbox& mailbox, F& f ) const
+	{
+		if (isLeaf())
+		{
+			for( const VoxelItem<T>* item : mItems )
+			{
+				if (mailbox.mark( item->mHandle.mIndex ) && f( item->mItem ) == false)
+				{
+					return( false );
+				}
+			}
+		}
+		else
+		{
+			for( Voxel<T>& child : mChildren->mVoxels )
+			{
+				if (child.forEachItem( mailbox, f ) == false)
+				{
+					return( false );
+				}
+			}
+		}
+		
+		return( true );
+	}
+	
+	// overlapping pairs of items in this voxel and below
+	// rootMax is the max corner of the root voxel
+	template< typename F >
+	bool forEachOverlappingPair( const vec3& rootMax, F& f ) const
+	{
+		if (isLeaf())
+		{
+			return( forEachLeafPair( rootMax, f ));
+		}
+		
+		for( const Voxel<T>& child : mChildren->mVoxels )
+		{
+			if (child.mNumItems > 1
+				&& child.forEachOverlappingPair( rootMax, f ) == false)
+			{
+				return( false );
+			}
+		}
+		
+		return( true );
+	}
+	
+	// parallel version of forEachOverlappingPair()
+	// children with at least minTaskItems items are walked as tasks in group
+	template< typename F >
+	void forEachOverlappingPairParallel( const vec3& rootMax, F& f, ThreadPool& pool,
+		TaskGroup& group, size_t minTaskItems ) const
+	{
+		if (isLeaf())
+		{
+			forEachLeafPair( rootMax, f );
+			return;
+		}
+		
+		for( const Voxel<T>& child : mChildren->mVoxels )
+		{
+			if (child.mNumItems < 2)
+			{
+				// no pairs
+			}
+			else if (static_cast< size_t >( child.mNumItems ) >= minTaskItems)
+			{
+				const Voxel<T>* task = &child;
+				pool.run( [=, &f, &pool, &group]()
+				{
+					task->forEachOverlappingPairParallel( rootMax, f, pool, group, minTaskItems );
+				}, group );
+			}
+			else
+			{
+				child.forEachOverlappingPair( rootMax, f );
+			}
+		}
+	}
+	
+	// pairs in a leaf
+	// a pair is in every leaf both its items touch. only the leaf holding
+	// the min corner of the overlap of the two item boxes reports it.
+	// leafs own [min, max), except on the max side of the root.
+	// item boxes are made in float32 like LeafBucket::intersects(), so
+	// the owning leaf always has both items
+	template< typename F >
+	bool forEachLeafPair( const vec3& rootMax, F& f ) const
+	{
+		vec3 leafMin = mBounds.getMin();
+		vec3 leafMax = mBounds.getMax();
+		size_t numItems = mItems.size();
+		for( size_t i=0; i<numItems; ++i )
+		{
+			vec3 p1 = mItems.getPos( i );
+			float32 r1 = static_cast< float32 >( mItems.mRadius[ i ] );
+			for( size_t j=i+1; j<numItems; ++j )
+			{
+				vec3 p2 = mItems.getPos( j );
+				float32 r2 = static_cast< float32 >( mItems.mRadius[ j ] );
+				
+				bool owned = true;
+				for( int32 axis=0; axis<3 && owned; ++axis )
+				{
+					float32 overlapMin = std::max( p1[ axis ] - r1, p2[ axis ] - r2 );
+					float32 overlapMax = std::min( p1[ axis ] + r1, p2[ axis ] + r2 );
+					owned = overlapMin <= overlapMax
+						&& overlapMin >= leafMin[ axis ]
+						&& (overlapMin < leafMax[ axis ] || leafMax[ axis ] == rootMax[ axis ]);
+				}
+				
+				if (owned
+					&& spheresOverlap( p1, mItems.mRadius[ i ], p2, mItems.mRadius[ j ] )
+					&& f( mItems.mItems[ i ]->mItem, mItems.mItems[ j ]->mItem ) == false)
+				{
+					return( false );
+				}
+			}
+		}
+		
+		return( true );
+	}
+	
+    // this voxel must touch bounds
+    void getVoxels( const Box3& bounds, std::vector< Box3 >& result ) const
+    {
+        if (isLeaf())
+        {
+            result.push_back( mBounds );
+        }
+        else
+        {
+            uint32 mask = getChildMask( bounds );
+            for( int32 c=0; c<8; ++c )
+            {
+                if (mask & (1 << c))
+                {
+                    mChildren->mVoxels[ c ].getVoxels( bounds, result );
+                }
+            }
+        }
+    }
+	
+	Box3 mBounds;
+	
+	// only leafs have items
+	LeafBucket< VoxelItem<T> > mItems;
+	Voxel* mParent;
+	// nullptr for a leaf
+	VoxelBlock< T >* mChildren;
+    int32 mNumItems;
+};
+
+// pairs of overlapping items between two trees, see spatialJoin()
+// the larger voxel is divided until both are leafs, voxel pairs that
+// don't touch are skipped
+template< typename TA, typename TB, typename F >
+bool joinVoxels( const Voxel< TA >& voxelA, const vec3& rootMaxA,
+	const Voxel< TB >& voxelB, const vec3& rootMaxB, F& f )
+{
+	if (voxelA.mNumItems == 0
+		|| voxelB.mNumItems == 0
+		|| voxelA.mBounds.intersects( voxelB.mBounds ) == false)
+	{
+		return( true );
+	}
+	
+	if (voxelA.isLeaf() == false
+		&& (voxelB.isLeaf() || voxelA.getVoxelSize() >= voxelB.getVoxelSize()))
+	{
+		for( const Voxel< TA >& child : voxelA.mChildren->mVoxels )
+		{
+			if (joinVoxels( child, rootMaxA, voxelB, rootMaxB, f ) == false)
+			{
+				return( false );
+			}
+		}
+		
+		return( true );
+	}
+	
+	if (voxelB.isLeaf() == false)
+	{
+		for( const Voxel< TB >& child : voxelB.mChildren->mVoxels )
+		{
+			if (joinVoxels( voxelA, rootMaxA, child, rootMaxB, f ) == false)
 			{
-				if (child->mChildren.size() > 0)
-				{
-					combine = false;
-					break;
-				}
+				return( false );
 			}
+		}
+		
+		return( true );
+	}
+	
+	// a pair is in every leaf pair its items touch. only the leafs holding
+	// the min corner of the overlap of the item boxes report it, as in
+	// Voxel::forEachLeafPair()
+	vec3 minA = voxelA.mBounds.getMin();
+	vec3 maxA = voxelA.mBounds.getMax();
+	vec3 minB = voxelB.mBounds.getMin();
+	vec3 maxB = voxelB.mBounds.getMax();
+	const LeafBucket< VoxelItem< TA > >& itemsA = voxelA.mItems;
+	const LeafBucket< VoxelItem< TB > >& itemsB = voxelB.mItems;
+	for( size_t i=0; i<itemsA.size(); ++i )
+	{
+		vec3 p1 = itemsA.getPos( i );
+		float32 r1 = static_cast< float32 >( itemsA.mRadius[ i ] );
+		for( size_t j=0; j<itemsB.size(); ++j )
+		{
+			vec3 p2 = itemsB.getPos( j );
+			float32 r2 = static_cast< float32 >( itemsB.mRadius[ j ] );
 			
-			// next check if dist is great enoug between furtherest objects
-			if (combine)
+			bool owned = true;
+			for( int32 axis=0; axis<3 && owned; ++axis )
 			{
-				for( Voxel<T>* child : mChildren)
-				{
-					if (child->isReducible( child->mItems, child->getVoxelSize(), minVoxelSize, maxDist ) == false)
-					{
-						for( VoxelItem<T>* item : child->mItems )
-						{
-							items.insert( item );
-						}
-					}
-					else
-					{
-						// don't change
-						combine = false;
-						break;
-					}
-				}
+				float32 overlapMin = std::max( p1[ axis ] - r1, p2[ axis ] - r2 );
+				float32 overlapMax = std::min( p1[ axis ] + r1, p2[ axis ] + r2 );
+				owned = overlapMin <= overlapMax
+					&& overlapMin >= minA[ axis ]
+					&& overlapMin >= minB[ axis ]
+					&& (overlapMin < maxA[ axis ] || maxA[ axis ] == rootMaxA[ axis ])
+					&& (overlapMin < maxB[ axis ] || maxB[ axis ] == rootMaxB[ axis ]);
 			}
 			
-			if (combine
-				&& isReducible( items, getVoxelSize(), minVoxelSize, maxDist ) == false)
+			if (owned
+				&& spheresOverlap( p1, itemsA.mRadius[ i ], p2, itemsB.mRadius[ j ] )
+				&& f( itemsA.mItems[ i ]->mItem, itemsB.mItems[ j ]->mItem ) == false)
 			{
-				// combine all childen
-				for( Voxel<T>* child : mChildren )
-				{
-					// must be leaf
-					errorCheck( child->mChildren.size() == 0 );
-					
-					for( ; child->mItems.size() > 0; )
-					{
-						VoxelItem<T>* item = *(child->mItems.begin());
-						child->remove( item );
-					}
-					
-					delete child;
-				}
-				
-				mChildren.clear();
-				
-				errorCheck( mItems.size() == 0 );
-				for( VoxelItem<T>* item : items )
-				{
-					add( item );
-				}
+				return( false );
 			}
 		}
 	}
 	
-	float64 getVoxelSize() const
+	return( true );
+}
+
+// children of a voxel are allocated together
+template< typename T >
+class VoxelBlock
+{
+public:
+	
+	Voxel< T > mVoxels[ 8 ];
+	
+	// NodeArena tick when allocated
+	uint32 mCreatedTick;
+};
+
+// owns the storage of all voxels and items in a tree
+// nodes are recycled through free lists and clear() releases
+// everything at once without walking the tree
+template< typename T >
+class NodeArena
+{
+public:
+	
+	NodeArena()
 	{
-		return( mBounds.getSize().mX );
+		mTick = 0;
 	}
 	
-	static bool isReducible( const std::set< VoxelItem<T>* >& items, float64 voxelSize, float64 minVoxelSize,
-			float64& maxAlignedDistOut )
+	VoxelBlock< T >* allocBlock( Voxel< T >* parent )
 	{
-		bool result;
-		maxAlignedDistOut = 0;
+		Box3 childBounds[ 8 ];
+		split8( parent->mBounds, childBounds );
+		
+		VoxelBlock< T >* block = mBlocks.alloc();
+		for( int32 i=0; i<8; ++i )
+		{
+			block->mVoxels[ i ].reset( parent, childBounds[ i ] );
+		}
 		
-		// assume this is a leaf node
-		// have to iterate over all children check if it can combine children
-		//errorCheck( mChildren.size() == 0 );
+		block->mCreatedTick = mTick;
+		return( block );
+	}
+	
+	void freeBlock( VoxelBlock< T >* block )
+	{
+		mBlocks.free( block );
+	}
+	
+	VoxelItem< T >* allocItem( T object, const vec3& p, float64 radius )
+	{
+		VoxelItem< T >* item = mItems.alloc();
+		item->reset( object, p, radius );
+		return( item );
+	}
+	
+	void freeItem( VoxelItem< T >* item )
+	{
+		mItems.free( item );
+	}
+	
+	void clear()
+	{
+		mBlocks.reset();
+		mItems.reset();
+	}
+	
+	size_t getNumBlocks() const
+	{
+		return( mBlocks.getNumAllocated() );
+	}
+	
+	size_t getNumItems() const
+	{
+		return( mItems.getNumAllocated() );
+	}
+	
+	// current time, in ticks
+	void tick()
+	{
+		++mTick;
+	}
+	
+	uint32 getTick() const
+	{
+		return( mTick );
+	}
+	
+	// ticks since a block was allocated
+	uint32 getAge( const VoxelBlock< T >* block ) const
+	{
+		return( mTick - block->mCreatedTick );
+	}
+	
+private:
+	
+	NodePool< VoxelBlock< T >, 64 > mBlocks;
+	NodePool< VoxelItem< T > > mItems;
+	uint32 mTick;
+};
 
-		if (items.size() <= 1)
+// T must be default constructible, items are pooled in a NodeArena
+// TItemIndex maps T to item handles (see itemtable.h)
+// use NoItemIndex for handle only access
+// TSplitPolicy decides when leafs divide, see DistanceSplitPolicy
+template< typename T, typename TItemIndex = HashItemIndex< T >,
+	typename TSplitPolicy = DistanceSplitPolicy >
+class octTree
+{
+public:
+	
+	// splitThreshold is passed to TSplitPolicy
+	octTree( const vec3& minBounds, const vec3& maxBounds, float64 minVoxelSize, int32 splitThreshold = 2 ) :
+		mSplitPolicy( minVoxelSize, splitThreshold )
+	{
+		mBounds.add( minBounds );
+		mBounds.add( maxBounds );
+		clear();
+	}
+	
+	// releases all voxels and items through the arena
+	// no recursive deletes
+	void clear()
+	{
+		mArena.clear();
+		mRoot.reset( nullptr, mBounds );
+		mHandles.clear();
+		mIndex.clear();
+		mItemSpeeds.clear();
+	}
+	
+	// returned handle stays valid until the item is removed
+	ItemHandle add( T object, const vec3& p, float64 radius )
+	{
+        Box3 box( p, radius );
+        
+		// must be in bounds of root
+		errorCheck( mRoot.mBounds.contains( box ) );
+		
+		VoxelItem<T>* item = mArena.allocItem( object, p, radius );
+		ItemHandle handle = mHandles.insert( item );
+		item->mHandle = handle;
+		
+		// must be unique
+		bool inserted = mIndex.insert( object, handle );
+		errorCheck( inserted );
+		
+		mRoot.add( item, box, mSplitPolicy, mArena );
+		
+		// must be in at least one voxel
+		errorCheck( item->mVoxels.size() > 0 );
+		
+		return( handle );
+	}
+	
+	bool remove( T object, bool combineVoxels = true )
+	{
+		ItemHandle handle = mIndex.find( object );
+		errorCheck( handle.valid() );
+		
+		bool result = remove( handle, combineVoxels );
+		errorCheck( result );
+		
+		return( result );
+	}
+	
+	// returns false if the handle is stale
+	bool remove( ItemHandle handle, bool combineVoxels = true )
+	{
+		VoxelItem<T>* item = mHandles.get( handle );
+		if (item == nullptr)
 		{
-			// can't get below 1 in all blocks
-			result = false;
+			return( false );
 		}
-		else if (voxelSize <= minVoxelSize)
+		
+		detach( item, combineVoxels );
+		eraseSpeed( item );
+		
+		mIndex.erase( item->mItem );
+		mHandles.erase( handle );
+		mArena.freeItem( item );
+		
+		return( true );
+	}
+	
+	// move an item, the handle stays the same
+	// only the smallest voxel holding both the old and new item box is
+	// updated, so an item that stays in its leafs just gets its new position.
+	// returns false if the handle is stale
+	bool update( ItemHandle handle, const vec3& p, float64 radius )
+	{
+		VoxelItem<T>* item = mHandles.get( handle );
+		if (item == nullptr)
 		{
-			// can't go any smaller
-			result = false;
+			return( false );
 		}
-		else
+		
+		Box3 oldBox( item->mPos, item->mRadius );
+		Box3 newBox( p, radius );
+		errorCheck( mRoot.mBounds.contains( newBox ) );
+		
+		// climb from one of the item's leafs. voxels above the first one
+		// with both boxes inside are not touched by the move
+		errorCheck( item->mVoxels.size() > 0 );
+		Voxel<T>* voxel = item->mVoxels[ 0 ];
+		while( voxel->mParent != nullptr
+			&& (voxel->mBounds.containsInterior( oldBox ) == false
+				|| voxel->mBounds.containsInterior( newBox ) == false))
 		{
-			// if smallest item is at least 2 min radii away from closest object,
-			// then it can be split
-			VoxelItem<T>* min = nullptr;
-			for( VoxelItem<T>* item : items )
-			{
-				if (min == nullptr)
-				{
-					min = item;
-				}
-				else
-				{
-					if (item->mRadius < min->mRadius)
-					{
-						min = item;
-					}
-				}
-			}
+			voxel = voxel->mParent;
+		}
+		
+		item->mPos = p;
+		item->mRadius = radius;
+		voxel->move( item, oldBox, newBox, mSplitPolicy, mArena );
+		errorCheck( item->mVoxels.size() > 0 );
+		
+		return( true );
+	}
+	
+	bool update( T object, const vec3& p, float64 radius )
+	{
+		return( update( mIndex.find( object ), p, radius ));
+	}
+	
+	// movement of an item over a step, used by sweepSphere()
+	// items start with no velocity. the tree doesn't move items itself
+	bool setVelocity( ItemHandle handle, const vec3& v )
+	{
+		VoxelItem<T>* item = mHandles.get( handle );
+		if (item == nullptr)
+		{
+			return( false );
+		}
+		
+		eraseSpeed( item );
+		item->mVelocity = v;
+		float64 speed = lengthVec( v );
+		if (speed > 0)
+		{
+			mItemSpeeds.insert( speed );
+		}
+		
+		return( true );
+	}
+	
+	bool setVelocity( T object, const vec3& v )
+	{
+		return( setVelocity( mIndex.find( object ), v ));
+	}
+	
+	// speed of the fastest item, sweepSphere() searches this much wider
+	// shrinks again when the item slows down or is removed
+	float64 getMaxItemSpeed() const
+	{
+		return( mItemSpeeds.empty() ? 0 : *mItemSpeeds.rbegin() );
+	}
+	
+	// move many items at once, e.g. everything that moved this frame
+	// TRange is a range of BuildItem< T >, each item at most once.
+	// items that stay in their leafs are updated in place. the rest are
+	// applied in one pass over the tree, so each voxel is visited once
+	// and splits or combines once, no matter how many items moved through it
+	template< typename TRange >
+	void updateMany( const TRange& updateItems )
+	{
+		mMoves.clear();
+		for( const BuildItem< T >& updateItem : updateItems )
+		{
+			VoxelItem<T>* item = mHandles.get( mIndex.find( updateItem.mItem ));
+			errorCheck( item != nullptr );
 			
-			// max aligned dist
-			// since voxels will be aligned to axis
-			float64 maxAlignedDist = 0;
-			for( VoxelItem<T>* item : items )
-			{
-				if (item != min)
-				{
-					for( int i=0; i<3; ++i )
-					{
-						float64 dist = fabs( item->mPos[ 0 ] - min->mPos[ 0 ] )
-							- item->mRadius - min->mRadius;
-						if (dist > maxAlignedDist)
-						{
-							maxAlignedDist = dist;
-						}
-					}
-				}
-			}
+			Box3 oldBox( item->mPos, item->mRadius );
+			Box3 newBox( updateItem.mPos, updateItem.mRadius );
+			errorCheck( mRoot.mBounds.contains( newBox ) );
 			
-			maxAlignedDistOut = maxAlignedDist;
-			if (maxAlignedDist > minVoxelSize)
+			item->mPos = updateItem.mPos;
+			item->mRadius = updateItem.mRadius;
+			
+			// still inside its only leaf
+			Voxel<T>* leaf = item->mVoxels[ 0 ];
+			if (item->mVoxels.size() == 1
+				&& leaf->mBounds.containsInterior( oldBox )
+				&& leaf->mBounds.containsInterior( newBox ))
 			{
-				result = true;
+				bool updated = leaf->mItems.update( item );
+				errorCheck( updated );
 			}
 			else
 			{
-				result = false;
+				mMoves.push_back( ItemMove< T >( item, oldBox, newBox ));
 			}
 		}
-
-		return( result );
+		
+		if (mMoves.size() > 0)
+		{
+			mMoveList.resize( mMoves.size() );
+			for( uint32 i=0; i<mMoves.size(); ++i )
+			{
+				mMoveList[ i ] = i;
+			}
+			
+			mRoot.moveMany( mMoves, mMoveList, 0, mMoveList.size(), mMoveMasks, mSplitPolicy, mArena );
+		}
+	}
+	
+	// bulk load, replaces the contents of the tree
+	// TRange is a range of BuildItem< T >. voxels are created top down
+	// exactly once, so nothing is migrated between parents and children.
+	// handles are returned in input order
+	template< typename TRange >
+	void build( const TRange& buildItems, std::vector< ItemHandle >* handlesOut = nullptr )
+	{
+		std::vector< VoxelItem<T>* > items;
+		beginBuild( buildItems, items, handlesOut );
+		
+		std::vector< uint8 > masks;
+		mRoot.build( items, 0, items.size(), masks, mSplitPolicy, mArena );
+	}
+	
+	// build() with octants built as tasks on pool
+	// the tree is the same as build() makes, voxel for voxel, for any
+	// number of threads. voxels with at least minTaskItems items are split
+	// off as tasks
+	template< typename TRange >
+	void buildParallel( const TRange& buildItems, ThreadPool& pool,
+		std::vector< ItemHandle >* handlesOut = nullptr, size_t minTaskItems = 2048 )
+	{
+		std::vector< VoxelItem<T>* > items;
+		beginBuild( buildItems, items, handlesOut );
+		
+		std::mutex arenaLock;
+		TaskGroup group;
+		mRoot.buildParallel( items, mSplitPolicy, mArena, arenaLock, pool, group, minTaskItems );
+		pool.wait( group );
+		
+		// item voxel lists are filled in one thread, in build() order
+		mRoot.linkItems();
+	}
+	
+	// advance the clock used by SplitPolicy::mMinLifetime
+	// call once per frame
+	void tick()
+	{
+		mArena.tick();
+	}
+	
+	// combine hysteresis, see SplitPolicy
+	// mergeThreshold should be below the split threshold. voxels younger
+	// than minLifetime ticks don't combine. with deferCombine only
+	// combine() does, e.g. as a maintenance pass between frames
+	void setCombineRules( int32 mergeThreshold, uint32 minLifetime, bool deferCombine )
+	{
+		errorCheck( mergeThreshold >= 1 );
+		mSplitPolicy.mMergeThreshold = mergeThreshold;
+		mSplitPolicy.mMinLifetime = minLifetime;
+		mSplitPolicy.mDeferCombine = deferCombine;
+	}
+	
+	// combine everything that can be
+	void combine()
+	{
+		combine( mRoot.mBounds );
+	}
+	
+	void combine( const Box3& bounds )
+	{
+		mRoot.combine( bounds, mSplitPolicy, mArena );
+	}
+	
+	void getItems( const vec3& p, float64 radius, std::set< T >& out ) const
+	{
+		forEachItem( Box3( p, radius ), [&out]( const T& item )
+		{
+			out.insert( item );
+			return( true );
+		} );
+	}
+	
+	// items are unique, in no particular order
+	void getItems( const vec3& p, float64 radius, std::vector< T >& out ) const
+	{
+		forEachItem( Box3( p, radius ), [&out]( const T& item )
+		{
+			out.push_back( item );
+			return( true );
+		} );
+	}
+	
+	// get items from a beam (line with radius)
+	void getItems( const vec3& p1, const vec3& p2, float64 radius, std::set< T >& out ) const
+	{
+		forEachItem( p1, p2, radius, [&out]( const T& item )
+		{
+			out.insert( item );
+			return( true );
+		} );
+	}
+	
+	void getItems( const vec3& p1, const vec3& p2, float64 radius, std::vector< T >& out ) const
+	{
+		forEachItem( p1, p2, radius, [&out]( const T& item )
+		{
+			out.push_back( item );
+			return( true );
+		} );
+	}
+	
+	// calls f( item ) once for every item intersecting bounds, no allocations
+	// f returns false to stop the query early, forEachItem() then returns false.
+	// uses a ThreadMailbox, so threads can query the same tree at once
+	template< typename F >
+	bool forEachItem( const Box3& bounds, F&& f ) const
+	{
+		ThreadMailbox< QueryMailbox > mailbox;
+		return( forEachItem( bounds, mailbox.get(), f ));
+	}
+	
+	// forEachItem() with the caller's mailbox
+	// for callers that keep one per thread or per task
+	template< typename F >
+	bool forEachItem( const Box3& bounds, QueryMailbox& mailbox, F&& f ) const
+	{
+		mailbox.begin( mHandles.capacity() );
+		if (mRoot.mBounds.intersects( bounds ) == false)
+		{
+			return( true );
+		}
+		
+		return( mRoot.forEachItem( bounds, bounds.getMin(), bounds.getMax(), mailbox, f ));
+	}
+	
+	// forEachItem() on a beam (line with radius)
+	template< typename F >
+	bool forEachItem( const vec3& p1, const vec3& p2, float64 radius, F&& f ) const
+	{
+		ThreadMailbox< QueryMailbox > mailbox;
+		return( forEachItem( p1, p2, radius, mailbox.get(), f ));
 	}
 	
-	void divide( float64 minVoxelSize )
+	template< typename F >
+	bool forEachItem( const vec3& p1, const vec3& p2, float64 radius, QueryMailbox& mailbox, F&& f ) const
 	{
-		// must not have been divided already
-		errorCheck( mChildren.size() == 0 );
-		
-		float64 maxAlignedDist;
-		bool reduce = isReducible( this->mItems, getVoxelSize(), minVoxelSize, maxAlignedDist );
-		if (reduce == false)
+		mailbox.begin( mHandles.capacity() );
+		if (mRoot.mBounds.getRayEntry( p1, p2, radius ) < 0)
 		{
-			return;
+			return( true );
 		}
 		
-		std::vector< Box3 > childBounds;
-		split8( mBounds, childBounds );
-		for( Box3& bounds : childBounds )
+		return( mRoot.forEachItem( p1, p2, p2 - p1, radius, mailbox, f ));
+	}
+	
+	// many getItems( p, radius ) queries at once
+	// TRange is a range of ItemQuery. queries are run in Morton order of
+	// their centers, kBatchSize at a time, and each group shares one walk
+	// down the tree. out gets the items of every query in query order,
+	// the items of one query come in no set order
+	template< typename TRange >
+	void getItemsBatch( const TRange& queries, BatchResult< T >& out ) const
+	{
+		std::vector< Box3 > boxes;
+		std::vector< std::pair< uint64, uint32 > > order;
+		for( const ItemQuery& query : queries )
 		{
-			Voxel< T >* childVoxel = new Voxel( this, bounds );
-			mChildren.push_back( childVoxel );
+			order.push_back( std::make_pair( mortonEncode( mBounds, query.mPos, kBatchMortonLevel ),
+				static_cast< uint32 >( boxes.size() )));
+			boxes.push_back( Box3( query.mPos, query.mRadius ));
 		}
 		
-		// migrate items to children
-		for( VoxelItem<T>* item : mItems )
+		std::sort( order.begin(), order.end() );
+		
+		std::vector< std::pair< uint32, T > > hits;
+		std::vector< uint32 > list;
+		vec3 rootMax = mRoot.mBounds.getMax();
+		for( size_t first=0; first<order.size(); first+=kBatchSize )
 		{
-			for( Voxel< T >* child : mChildren )
+			size_t last = std::min( first + kBatchSize, order.size() );
+			list.clear();
+			for( size_t i=first; i<last; ++i )
 			{
-				float64 radius = item->mRadius;
-				Box3 box( item->mPos, radius );
-				if (child->mBounds.intersects( box ))
+				if (mRoot.mBounds.intersects( boxes[ order[ i ].second ] ))
 				{
-                    child->mNumItems++;
-					child->add( item );
+					list.push_back( order[ i ].second );
 				}
 			}
-		}
-		
-		// check if a reduction was made
-		int32 maxNumber = 0;
-		
-		for( Voxel< T >* child : mChildren )
-		{
-			int32 childNumItems = child->mItems.size();
-			if (childNumItems > maxNumber)
+			
+			if (list.size() > 0)
 			{
-				maxNumber = childNumItems;
+				mRoot.getItemsBatch( boxes, list, 0, list.size(), rootMax, hits );
 			}
 		}
 		
-		float64 childVoxelSize = getVoxelSize() / 2 ;
-		if (maxAlignedDist > childVoxelSize)
+		// counting sort of the hits by query
+		out.mOffsets.assign( boxes.size() + 1, 0 );
+		for( const std::pair< uint32, T >& hit : hits )
 		{
-			// must have been reduced
-			errorCheck( maxNumber < static_cast< int64 >( mItems.size() ) );
+			out.mOffsets[ hit.first + 1 ]++;
 		}
 		
-		// migrate items from parent to children
-		errorCheck( mItems.size() > 0 );
-		
-		for( ; mItems.size() > 0; )
+		for( size_t i=0; i<boxes.size(); ++i )
 		{
-			VoxelItem<T>* item = *(mItems.begin());
-			this->remove( item );
+			out.mOffsets[ i + 1 ] += out.mOffsets[ i ];
 		}
 		
-		// look to subdivide further
-		for( Voxel<T>* child : mChildren )
+		out.mItems.resize( hits.size() );
+		list.assign( out.mOffsets.begin(), out.mOffsets.end() - 1 );
+		for( const std::pair< uint32, T >& hit : hits )
 		{
-			child->divide( minVoxelSize );
+			out.mItems[ list[ hit.first ]++ ] = hit.second;
 		}
 	}
 	
-	void getItems( const Box3& bounds, std::set< T >& out ) const
+	// many queries at once on pool
+	// TRange is a range of ItemQuery, BeamQuery or NearestQuery. queries are
+	// split in Morton order of their centers into tasks of kParallelQueries,
+	// and each worker thread queries with its own ThreadMailbox. out gets
+	// the same items in the same order as the single query gives for each
+	// query, packed in query order. nothing in the tree is written, so
+	// parallel queries and other const queries can overlap
+	template< typename TRange >
+	void queryParallel( const TRange& queries, ThreadPool& pool, BatchResult< T >& out ) const
 	{
-		if (mBounds.intersects( bounds ))
+		std::vector< std::pair< uint64, uint32 > > order;
+		std::vector< const typename std::decay< decltype( *std::begin( queries )) >::type* > list;
+		for( const auto& query : queries )
 		{
-			if (mChildren.size() > 0)
-			{
-				// tree node
-				// if children, all items should be in children
-				errorCheck( mItems.size() == 0 );
-				for( Voxel<T>* child : mChildren )
-				{
-					child->getItems( bounds, out );
-				}
-			}
-			else
+			order.push_back( std::make_pair( mortonEncode( mBounds, getQueryCenter( query ), kBatchMortonLevel ),
+				static_cast< uint32 >( list.size() )));
+			list.push_back( &query );
+		}
+		
+		std::sort( order.begin(), order.end() );
+		
+		// each task packs its queries' items in its own vector,
+		// starts and counts say where a query's items are
+		size_t numTasks = (order.size() + kParallelQueries - 1) / kParallelQueries;
+		std::vector< std::vector< T > > taskItems( numTasks );
+		std::vector< uint32 > starts( list.size() );
+		out.mOffsets.assign( list.size() + 1, 0 );
+		
+		TaskGroup group;
+		for( size_t task=0; task<numTasks; ++task )
+		{
+			pool.run( [this, task, &order, &list, &taskItems, &starts, &out]()
 			{
-				// leaf node
-				
-				for( VoxelItem<T>* item: mItems )
+				ThreadMailbox< QueryMailbox > mailbox;
+				std::vector< T >& items = taskItems[ task ];
+				size_t last = std::min( (task + 1) * kParallelQueries, order.size() );
+				for( size_t i=task * kParallelQueries; i<last; ++i )
 				{
-					Box3 childBounds( item->mPos, item->mRadius );
-					if (childBounds.intersects( bounds ))
-					{
-						out.insert( item->mItem );
-					}
+					uint32 query = order[ i ].second;
+					starts[ query ] = static_cast< uint32 >( items.size() );
+					runQuery( *list[ query ], mailbox.get(), items );
+					out.mOffsets[ query + 1 ] = static_cast< uint32 >( items.size() ) - starts[ query ];
 				}
-			}
+			}, group );
+		}
+		
+		pool.wait( group );
+		
+		for( size_t i=0; i<list.size(); ++i )
+		{
+			out.mOffsets[ i + 1 ] += out.mOffsets[ i ];
+		}
+		
+		out.mItems.resize( out.mOffsets.back() );
+		for( size_t i=0; i<order.size(); ++i )
+		{
+			uint32 query = order[ i ].second;
+			const T* items = taskItems[ i / kParallelQueries ].data() + starts[ query ];
+			std::copy( items, items + (out.mOffsets[ query + 1 ] - out.mOffsets[ query ]),
+				out.mItems.begin() + out.mOffsets[ query ] );
 		}
 	}
 	
-	void getItems( const vec3& p1, const vec3& p2, float64 radius, std::set< T >& out ) const
+	// items hit by each beam of a packet, out[ i ] gets ray i's items
+	// same items in the same order as getItems( p1, p2, radius, out )
+	// for each ray, in one walk of the tree
+	void getItems( const RayPacket& packet, std::vector< T >* out ) const
 	{
-		if (mBounds.intersects( p1, p2, radius ) == false)
+		forEachItem( packet, [out]( int32 ray, const T& item )
 		{
-			// does not intersect this voxel
-		}
-		else if (mChildren.size() == 0 )
+			out[ ray ].push_back( item );
+			return( true );
+		} );
+	}
+	
+	// calls f( ray, item ) once per ray for every item it hits
+	// f returns false to stop the query early
+	template< typename F >
+	bool forEachItem( const RayPacket& packet, F&& f ) const
+	{
+		ThreadMailbox< PacketMailbox > mailbox;
+		return( forEachItem( packet, mailbox.get(), f ));
+	}
+	
+	// packet forEachItem() with the caller's mailbox
+	template< typename F >
+	bool forEachItem( const RayPacket& packet, PacketMailbox& mailbox, F&& f ) const
+	{
+		mailbox.begin( mHandles.capacity() );
+		uint32 rayMask = 0;
+		for( int32 ray=0; ray<packet.mNumRays; ++ray )
 		{
-			// leaf node
-			vec3 v = p2 - p1;
-			for( VoxelItem<T>* item : mItems )
+			if (mRoot.mBounds.getRayEntry( packet.mP1[ ray ], packet.mP2[ ray ], packet.mRadius[ ray ] ) >= 0)
 			{
-				if (getCollision( p1, v, item->mPos, radius + item->mRadius ) >= 0)
-				{
-					out.insert( item->mItem );
-				}
+				rayMask |= (1 << ray);
 			}
 		}
-		else
+		
+		if (rayMask == 0)
 		{
-			// tree node - recurse
-			for( Voxel<T>* child : mChildren )
-			{
-				child->getItems( p1, p2, radius, out );
-			}
+			return( true );
 		}
+		
+		return( mRoot.forEachItem( packet, rayMask, mailbox, f ));
 	}
-
-    void getVoxels( const Box3& bounds, std::vector< Box3 >& result ) const
-    {
-        if (mBounds.intersects( bounds ) == false)
-        {
-            // none to add
-        }
-        else if (mChildren.size() == 0)
-        {
-            result.push_back( mBounds );
-        }
-        else
-        {
-            for( Voxel* child : mChildren )
-            {
-                child->getVoxels( bounds, result );
-            }
-        }
-    }
 	
-	Box3 mBounds;
+	// items inside or crossing a frustum
+	void getItems( const Frustum& frustum, std::vector< T >& out ) const
+	{
+		getItems( frustum.getPlanes(), Frustum::kNumPlanes, out );
+	}
 	
-	std::set< VoxelItem<T>* > mItems;
-	Voxel* mParent;
-	std::vector< Voxel< T >* > mChildren;
-    int32 mNumItems;
-};
-
-template< typename T >
-class octTree
-{
-public:
+	// items inside or crossing a convex polytope
+	// the polytope is the intersection of the half spaces the plane
+	// normals point to. at most 32 planes. an item is found if, in a leaf
+	// holding it, its sphere is inside or crossing every plane that cuts
+	// the leaf. so all items of leafs fully inside are found, and every
+	// item whose sphere reaches the polytope, plus some near its edges
+	// whose box does
+	void getItems( const Plane* planes, int32 numPlanes, std::vector< T >& out ) const
+	{
+		forEachItem( planes, numPlanes, [&out]( const T& item )
+		{
+			out.push_back( item );
+			return( true );
+		} );
+	}
 	
-	octTree( const vec3& minBounds, const vec3& maxBounds, float64 minVoxelSize, int32 splitThreshold = 2 )
+	// forEachItem() on a convex polytope, see getItems()
+	// voxels fully inside are enumerated without testing their items
+	template< typename F >
+	bool forEachItem( const Plane* planes, int32 numPlanes, F&& f ) const
 	{
-		mBounds.add( minBounds );
-		mBounds.add( maxBounds );
-		mMinVoxelSize = minVoxelSize;
-        mSplitThreshold = splitThreshold;
-		mRoot = nullptr;
-		clear();
+		ThreadMailbox< QueryMailbox > mailbox;
+		return( forEachItem( planes, numPlanes, mailbox.get(), f ));
 	}
 	
-	~octTree()
+	template< typename F >
+	bool forEachItem( const Plane* planes, int32 numPlanes, QueryMailbox& mailbox, F&& f ) const
 	{
-		delete mRoot;
+		errorCheck( numPlanes >= 0 && numPlanes <= 32 );
+		
+		uint32 planeMask = (numPlanes == 32) ? 0xffffffff : ((1u << numPlanes) - 1);
+		mailbox.begin( mHandles.capacity() );
+		return( mRoot.forEachItem( planes, numPlanes, planeMask, mailbox, f ));
 	}
 	
-	void clear()
+	// calls f( a, b ) once for every pair of items whose spheres overlap
+	// a single walk over the leafs, pairs come in no set order.
+	// f returns false to stop early
+	template< typename F >
+	bool forEachOverlappingPair( F&& f ) const
 	{
-		delete mRoot;
-		mRoot = new Voxel<T>( nullptr, mBounds );
-		mItems.clear();
+		return( mRoot.forEachOverlappingPair( mRoot.mBounds.getMax(), f ));
 	}
 	
-	void add( T object, const vec3& p, float64 radius )
+	// forEachOverlappingPair() with octants walked as tasks on pool
+	// f is called from several threads at once and can't stop the walk,
+	// its return value is ignored. voxels with at least minTaskItems
+	// items are split off as tasks
+	template< typename F >
+	void forEachOverlappingPairParallel( ThreadPool& pool, F&& f, size_t minTaskItems = 256 ) const
 	{
-		// must be unique
-		auto itemIter = mItems.find( object );
-		errorCheck( itemIter == mItems.end() );
-		
-        Box3 box( p, radius );
-        
-		// must be in bounds of root
-		errorCheck( mRoot->mBounds.contains( box ) );
+		auto visit = [&f]( const T& a, const T& b )
+		{
+			f( a, b );
+			return( true );
+		};
 		
-		VoxelItem<T>* item = new VoxelItem<T>( object, p, radius );
-		typename std::map< T, VoxelItem< T >* >::value_type value( object, item );
-		auto insertResult = mItems.insert( value );
-		errorCheck( insertResult.second == true );
+		TaskGroup group;
+		mRoot.forEachOverlappingPairParallel( mRoot.mBounds.getMax(), visit, pool, group, minTaskItems );
+		pool.wait( group );
+	}
+	
+	// items hit by a sphere moving from p to p + v over a step
+	// hits are added to out by time of impact, 0 at p and 1 at p + v,
+	// items already touching at the start have t 0. items with a
+	// velocity move over the same step, so fast items can't pass
+	// through the sphere between steps
+	void sweepSphere( const vec3& p, const vec3& v, float64 radius,
+		std::vector< SweepHit< T > >& out ) const
+	{
+		ThreadMailbox< QueryMailbox > mailbox;
+		sweepSphere( p, v, radius, mailbox.get(), out );
+	}
+	
+	// sweepSphere() with the caller's mailbox
+	void sweepSphere( const vec3& p, const vec3& v, float64 radius, QueryMailbox& mailbox,
+		std::vector< SweepHit< T > >& out ) const
+	{
+		size_t first = out.size();
 		
-		mRoot->add( item, box, mMinVoxelSize );
+		// a moving item can reach the sweep from its speed away
+		float64 searchRadius = radius + getMaxItemSpeed();
+		mailbox.begin( mHandles.capacity() );
+		auto visit = [&]( const VoxelItem<T>* item )
+		{
+			float64 t = getCollision( p, v, item->mPos, item->mVelocity, radius + item->mRadius );
+			if (t >= 0)
+			{
+				out.push_back( SweepHit< T >( item->mItem, t ));
+			}
+		};
+		if (mRoot.mBounds.getRayEntry( p, p + v, searchRadius ) >= 0)
+		{
+			mRoot.forEachBeamItem( p, p + v, searchRadius, mailbox, visit );
+		}
 		
-		// must be in at least one voxel
-		errorCheck( item->mVoxels.size() > 0 );
+		std::stable_sort( out.begin() + first, out.end(), []( const SweepHit< T >& left, const SweepHit< T >& right )
+		{
+			return( left.mT < right.mT );
+		} );
 	}
 	
-	bool remove( T object, bool combineVoxels = true )
+	// closest item hit by a beam (line with radius)
+	// tOut is the getCollision() t of the hit, 0 at p1 and 1 at p2.
+	// false if nothing is hit
+	bool raycastFirst( const vec3& p1, const vec3& p2, float64 radius, T& itemOut, float64& tOut ) const
 	{
-		auto iter = mItems.find( object );
-		errorCheck( iter != mItems.end() );
-		
-		VoxelItem<T>* item = iter->second;
-		Box3 bounds( item->mPos, item->mRadius );
-		mRoot->remove( item, bounds, mMinVoxelSize, combineVoxels );
+		ThreadMailbox< QueryMailbox > mailbox;
+		return( raycastFirst( p1, p2, radius, mailbox.get(), itemOut, tOut ));
+	}
+	
+	// raycastFirst() with the caller's mailbox
+	bool raycastFirst( const vec3& p1, const vec3& p2, float64 radius, QueryMailbox& mailbox,
+		T& itemOut, float64& tOut ) const
+	{
+		if (mRoot.mBounds.getRayEntry( p1, p2, radius ) < 0)
+		{
+			return( false );
+		}
 		
-		// verify removed from all voxels
-		errorCheck( item->mVoxels.size() == 0 );
+		mailbox.begin( mHandles.capacity() );
 		
-		mItems.erase( iter );
-		delete item;
+		const VoxelItem<T>* bestItem = nullptr;
+		float64 bestT = 0;
+		mRoot.raycastFirst( p1, p2, p2 - p1, radius, mailbox, bestItem, bestT );
+		if (bestItem == nullptr)
+		{
+			return( false );
+		}
 		
+		itemOut = bestItem->mItem;
+		tOut = bestT;
 		return( true );
 	}
 	
-	void combine( const Box3& bounds )
-	{
-		mRoot->combine( bounds, mMinVoxelSize );
-	}
-	
-	void getItems( const vec3& p, float64 radius, std::set< T >& out ) const
+	// the k items closest to p, nearest first
+	// distance is to the item's surface, 0 if p is inside it.
+	// items further than maxDist are left out. voxels and items are
+	// visited best first, so only voxels closer than the k-th item are opened
+	void getNearest( const vec3& p, size_t k, float64 maxDist, std::vector< T >& out,
+		std::vector< float64 >* distancesOut = nullptr ) const
 	{
-		Box3 bounds( p, radius );
-		mRoot->getItems( bounds, out );
+		ThreadMailbox< QueryMailbox > mailbox;
+		getNearest( p, k, maxDist, mailbox.get(), out, distancesOut );
 	}
 	
-	// get items from a beam (line with radius)
-	void getItems( const vec3& p1, const vec3& p2, float64 radius, std::set< T >& out ) const
+	// getNearest() with the caller's mailbox
+	void getNearest( const vec3& p, size_t k, float64 maxDist, QueryMailbox& mailbox,
+		std::vector< T >& out, std::vector< float64 >* distancesOut = nullptr ) const
 	{
-		mRoot->getItems( p1, p2, radius, out );
+		if (k == 0)
+		{
+			return;
+		}
+		
+		mailbox.begin( mHandles.capacity() );
+		
+		// min heap of voxels and items by distance
+		std::vector< NearestEntry > heap;
+		auto greater = []( const NearestEntry& left, const NearestEntry& right )
+		{
+			return( left.mDist > right.mDist );
+		};
+		
+		heap.push_back( NearestEntry( mRoot.mBounds.getDist( p ), &mRoot, nullptr ));
+		size_t numFound = 0;
+		while( heap.size() > 0 && numFound < k )
+		{
+			std::pop_heap( heap.begin(), heap.end(), greater );
+			NearestEntry entry = heap.back();
+			heap.pop_back();
+			
+			if (entry.mDist > maxDist)
+			{
+				break;
+			}
+			
+			if (entry.mItem != nullptr)
+			{
+				// nothing left in the heap is closer
+				out.push_back( entry.mItem->mItem );
+				if (distancesOut != nullptr)
+				{
+					distancesOut->push_back( entry.mDist );
+				}
+				
+				numFound++;
+			}
+			else if (entry.mVoxel->isLeaf())
+			{
+				const LeafBucket< VoxelItem<T> >& bucket = entry.mVoxel->mItems;
+				for( size_t i=0; i<bucket.size(); ++i )
+				{
+					const VoxelItem<T>* item = bucket.mItems[ i ];
+					if (mailbox.mark( item->mHandle.mIndex ))
+					{
+						float64 dist = lengthVec( item->mPos - p ) - item->mRadius;
+						dist = std::max( dist, 0.0 );
+						if (dist <= maxDist)
+						{
+							heap.push_back( NearestEntry( dist, nullptr, item ));
+							std::push_heap( heap.begin(), heap.end(), greater );
+						}
+					}
+				}
+			}
+			else
+			{
+				for( const Voxel<T>& child : entry.mVoxel->mChildren->mVoxels )
+				{
+					float64 dist = child.mBounds.getDist( p );
+					if (dist <= maxDist)
+					{
+						heap.push_back( NearestEntry( dist, &child, nullptr ));
+						std::push_heap( heap.begin(), heap.end(), greater );
+					}
+				}
+			}
+		}
 	}
 	
     // debug an item that should found
     void debugItem( const vec3& p1, const vec3& p2, float64 radius, T item )
     {
-        auto iter = mItems.find( item );
-        errorCheck( iter != mItems.end() );
+        VoxelItem<T>* voxelItem = mHandles.get( mIndex.find( item ));
+        errorCheck( voxelItem != nullptr );
         
-        VoxelItem<T>* voxelItem = iter->second;
         int32 numVoxels = 0;
         for( Voxel<T>* voxel : voxelItem->mVoxels )
         {
@@ -689,13 +2882,17 @@ public:
 	using TBounds = std::vector< Box3 >;
 	bool getVoxels( T object, TBounds& boundsOut ) const
 	{
-		auto iter = mItems.find( object );
-		if (iter == mItems.end())
+		return( getVoxels( mIndex.find( object ), boundsOut ));
+	}
+	
+	bool getVoxels( ItemHandle handle, TBounds& boundsOut ) const
+	{
+		VoxelItem<T>* item = mHandles.get( handle );
+		if (item == nullptr)
 		{
 			return( false );
 		}
 		
-		VoxelItem<T>* item = iter->second;
 		for( Voxel< T >* voxel : item->mVoxels )
 		{
 			boundsOut.push_back( voxel->mBounds );
@@ -706,9 +2903,23 @@ public:
 	
 	void getVoxels( const Box3& bounds, TBounds& out ) const
 	{
-        mRoot->getVoxels( bounds, out );
+        if (mRoot.mBounds.intersects( bounds ))
+        {
+            mRoot.getVoxels( bounds, out );
+        }
     }
 	
+	// invalid handle if not in the tree
+	ItemHandle getHandle( T object ) const
+	{
+		return( mIndex.find( object ));
+	}
+	
+	bool contains( ItemHandle handle ) const
+	{
+		return( mHandles.get( handle ) != nullptr );
+	}
+	
 	Box3 getBounds() const
 	{
 		return( mBounds );
@@ -716,18 +2927,164 @@ public:
 	
 	size_t getNumItems() const
 	{
-		return( mItems.size() );
+		return( mHandles.size() );
+	}
+	
+	// total voxels, including tree nodes
+	size_t getNumVoxels() const
+	{
+		return( 1 + (mArena.getNumBlocks() * 8) );
 	}
 	
 private:
 	
+	// queryParallel() center of a query, for Morton order
+	static vec3 getQueryCenter( const ItemQuery& query )
+	{
+		return( query.mPos );
+	}
+	
+	static vec3 getQueryCenter( const BeamQuery& query )
+	{
+		return( (query.mP1 + query.mP2) * 0.5 );
+	}
+	
+	static vec3 getQueryCenter( const NearestQuery& query )
+	{
+		return( query.mPos );
+	}
+	
+	// queryParallel() query, adds its items to out
+	void runQuery( const ItemQuery& query, QueryMailbox& mailbox, std::vector< T >& out ) const
+	{
+		forEachItem( Box3( query.mPos, query.mRadius ), mailbox, [&out]( const T& item )
+		{
+			out.push_back( item );
+			return( true );
+		} );
+	}
+	
+	void runQuery( const BeamQuery& query, QueryMailbox& mailbox, std::vector< T >& out ) const
+	{
+		forEachItem( query.mP1, query.mP2, query.mRadius, mailbox, [&out]( const T& item )
+		{
+			out.push_back( item );
+			return( true );
+		} );
+	}
+	
+	void runQuery( const NearestQuery& query, QueryMailbox& mailbox, std::vector< T >& out ) const
+	{
+		getNearest( query.mPos, query.mK, query.mMaxDist, mailbox, out );
+	}
+	
+	// getNearest() heap entry, a voxel or an item
+	class NearestEntry
+	{
+	public:
+		
+		NearestEntry( float64 dist, const Voxel<T>* voxel, const VoxelItem<T>* item )
+		{
+			mDist = dist;
+			mVoxel = voxel;
+			mItem = item;
+		}
+		
+		float64 mDist;
+		const Voxel<T>* mVoxel;
+		const VoxelItem<T>* mItem;
+	};
+	
+	// clear the tree and make the items for a build
+	template< typename TRange >
+	void beginBuild( const TRange& buildItems, std::vector< VoxelItem<T>* >& items,
+		std::vector< ItemHandle >* handlesOut )
+	{
+		clear();
+		
+		for( const BuildItem< T >& buildItem : buildItems )
+		{
+			// must be in bounds of root
+			errorCheck( mRoot.mBounds.contains( Box3( buildItem.mPos, buildItem.mRadius )));
+			
+			VoxelItem<T>* item = mArena.allocItem( buildItem.mItem, buildItem.mPos, buildItem.mRadius );
+			ItemHandle handle = mHandles.insert( item );
+			item->mHandle = handle;
+			
+			// must be unique
+			bool inserted = mIndex.insert( buildItem.mItem, handle );
+			errorCheck( inserted );
+			
+			items.push_back( item );
+			if (handlesOut != nullptr)
+			{
+				handlesOut->push_back( handle );
+			}
+		}
+	}
+	
+	// take an item out of all its voxels
+	void detach( VoxelItem<T>* item, bool combineVoxels )
+	{
+		Box3 bounds( item->mPos, item->mRadius );
+		mRoot.remove( item, bounds, mSplitPolicy, combineVoxels, mArena );
+		
+		// verify removed from all voxels
+		errorCheck( item->mVoxels.size() == 0 );
+	}
+	
+	// drop the item's speed from mItemSpeeds, if it moves
+	void eraseSpeed( const VoxelItem<T>* item )
+	{
+		float64 speed = lengthVec( item->mVelocity );
+		if (speed > 0)
+		{
+			auto it = mItemSpeeds.find( speed );
+			errorCheck( it != mItemSpeeds.end() );
+			mItemSpeeds.erase( it );
+		}
+	}
+	
 	Box3 mBounds;
-    int32 mSplitThreshold;
-	float64 mMinVoxelSize;
-	Voxel< T > * mRoot = nullptr;
-	std::map< T, VoxelItem< T >* > mItems;
+	TSplitPolicy mSplitPolicy;
+	NodeArena< T > mArena;
+	Voxel< T > mRoot;
+	ItemTable< VoxelItem< T > > mHandles;
+	TItemIndex mIndex;
+	
+	// getItemsBatch() queries per walk, and the Morton grid they are sorted on
+	static constexpr size_t kBatchSize = 256;
+	static constexpr int32 kBatchMortonLevel = 10;
+	
+	// queryParallel() queries per task
+	static constexpr size_t kParallelQueries = 64;
 	
+	// speeds of the items that move, the largest widens sweepSphere()
+	std::multiset< float64 > mItemSpeeds;
+	
+	// updateMany() scratch, kept so a frame's moves don't allocate
+	std::vector< ItemMove< T > > mMoves;
+	std::vector< uint32 > mMoveList;
+	std::vector< uint8 > mMoveMasks;
+	
+	template< typename TA, typename TItemIndexA, typename TSplitPolicyA,
+		typename TB, typename TItemIndexB, typename TSplitPolicyB, typename F >
+	friend bool spatialJoin( const octTree< TA, TItemIndexA, TSplitPolicyA >& treeA,
+		const octTree< TB, TItemIndexB, TSplitPolicyB >& treeB, F&& f );
 };
 
+// calls f( a, b ) once for every item a in treeA and b in treeB whose
+// spheres overlap. both trees are walked together and voxel pairs that
+// don't touch are skipped, so the trees can have any bounds and voxel
+// sizes. f returns false to stop early
+template< typename TA, typename TItemIndexA, typename TSplitPolicyA,
+	typename TB, typename TItemIndexB, typename TSplitPolicyB, typename F >
+bool spatialJoin( const octTree< TA, TItemIndexA, TSplitPolicyA >& treeA,
+	const octTree< TB, TItemIndexB, TSplitPolicyB >& treeB, F&& f )
+{
+	return( joinVoxels( treeA.mRoot, treeA.mRoot.mBounds.getMax(),
+		treeB.mRoot, treeB.mRoot.mBounds.getMax(), f ));
+}
+
 
 #endif
@@ -1,15 +1,93 @@
 
 #include "octtree.h"
+#include "linearocttree.h"
+#include "looseocttree.h"
+#include "concurrentocttree.h"
 
-void testBasicOctTree();
-void testOctTreeSpan();
-void testBigOctTree();
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <type_traits>
 
-int main()
+class OctItem;
+
+template< typename TTree > void testBasicOctTree();
+template< typename TTree > void testOctTreeSpan();
+template< typename TTree > void testBigOctTree();
+template< typename TTree > void benchOctTree( const char* name, int32 splitThreshold = 2 );
+void testOctTreeArena();
+void testOctTreeLeafBucket();
+void testOctTreeHandles();
+void testOctTreeBuild();
+void testOctTreeBuildParallel();
+void testOctTreeForEach();
+void testOctTreeMailbox();
+void testOctTreeNearest();
+void testOctTreePolytope();
+void testOctTreeRaycast();
+void testOctTreeUpdate();
+void testOctTreeUpdateMany();
+template< typename TPolicy > void testOctTreeSplitPolicy( int32 splitThreshold );
+void testOctTreeHysteresis();
+void testOctTreeLoose();
+void testOctTreePairs();
+void testOctTreeJoin();
+void testOctTreeSweep();
+void testOctTreeChildMask();
+void testOctTreeLeafKernels();
+void testOctTreeRayPacket();
+void testOctTreeBatch();
+void testOctTreeQueryParallel();
+void testOctTreeConcurrent();
+
+int main( int argc, char** argv )
 {
-	testBasicOctTree();
-	testOctTreeSpan();
-	testBigOctTree();
+	testBasicOctTree< octTree< OctItem* > >();
+	testOctTreeSpan< octTree< OctItem* > >();
+	testBigOctTree< octTree< OctItem* > >();
+	
+	// same tests on the linear backend
+	testBasicOctTree< linearOctTree< OctItem* > >();
+	testOctTreeSpan< linearOctTree< OctItem* > >();
+	testBigOctTree< linearOctTree< OctItem* > >();
+	
+	testOctTreeArena();
+	testOctTreeLeafBucket();
+	testOctTreeHandles();
+	testOctTreeBuild();
+	testOctTreeBuildParallel();
+	testOctTreeForEach();
+	testOctTreeMailbox();
+	testOctTreeNearest();
+	testOctTreePolytope();
+	testOctTreeRaycast();
+	testOctTreeUpdate();
+	testOctTreeUpdateMany();
+	testOctTreeSplitPolicy< CapacitySplitPolicy >( 8 );
+	testOctTreeSplitPolicy< HybridSplitPolicy >( 8 );
+	testOctTreeHysteresis();
+	testOctTreeLoose();
+	testOctTreePairs();
+	testOctTreeJoin();
+	testOctTreeSweep();
+	testOctTreeChildMask();
+	testOctTreeLeafKernels();
+	testOctTreeRayPacket();
+	testOctTreeBatch();
+	testOctTreeQueryParallel();
+	testOctTreeConcurrent();
+	
+	// timings only when asked for, test runs stay quiet
+	if (argc > 1
+		&& strcmp( argv[ 1 ], "bench" ) == 0)
+	{
+		benchOctTree< octTree< OctItem* > >( "octTree" );
+		benchOctTree< linearOctTree< OctItem* > >( "linearOctTree" );
+		benchOctTree< octTree< OctItem*, HashItemIndex< OctItem* >, CapacitySplitPolicy > >( "octTree capacity 16", 16 );
+		benchOctTree< octTree< OctItem*, HashItemIndex< OctItem* >, HybridSplitPolicy > >( "octTree hybrid 16", 16 );
+	}
 }
 
 class OctItem
@@ -54,6 +132,7 @@ bool verifyVoxels( const std::vector< Box3 >& set, const std::vector< Box3 >& su
 
 
 
+template< typename TTree >
 void testBasicOctTree()
 {
 	// make space power of 2, so voxels are interger size
@@ -61,7 +140,7 @@ void testBasicOctTree()
 	vec3 minSize( -8, -8, -8 );
 	vec3 maxSize( 8, 8, 8 );
 	
-	octTree< OctItem* > tree( minSize, maxSize, 1 );
+	TTree tree( minSize, maxSize, 1 );
     std::set< OctItem* > items;
 	
 	
@@ -233,12 +312,13 @@ void testBasicOctTree()
 }
 
 // test octtree with items overlapping multiple voxels
+template< typename TTree >
 void testOctTreeSpan()
 {
 	vec3 minSize( -8, -8, -8 );
 	vec3 maxSize( 8, 8, 8 );
 	
-	octTree< OctItem* > tree( minSize, maxSize, 1 );
+	TTree tree( minSize, maxSize, 1 );
 	std::set< OctItem* > items;
 	
 	OctItem i1( vec3( 0, 0, 0 ), .5 );
@@ -288,6 +368,7 @@ void testOctTreeSpan()
 	
 }
 
+template< typename TTree >
 void testBigOctTree()
 {
 	float32 space = 1.0;
@@ -295,7 +376,7 @@ void testBigOctTree()
 	vec3 minSize( -8, -8, -8 );
 	vec3 maxSize( 8, 8, 8 );
 	
-	octTree< OctItem* > tree( minSize, maxSize, 1.0 );
+	TTree tree( minSize, maxSize, 1.0 );
 	
 	std::vector< OctItem* > items2;
 	
@@ -404,3 +485,2102 @@ void testBigOctTree()
 	errorCheck( voxels.size() == 1 );
 	errorCheck( voxels[ 0 ] == Box3( kOrigin3, 8 ) );
 }
+
+// test voxels and items are recycled by the arena
+void testOctTreeArena()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	octTree< OctItem* > tree( minSize, maxSize, 1 );
+	errorCheck( tree.getNumVoxels() == 1 );
+	
+	OctItem i1( vec3( 2, 2, 2 ), 1 );
+	OctItem i2( vec3( -4, -4, -4 ), 1 );
+	OctItem i3( vec3( 6, 6, 6 ), 1 );
+	
+	// churn the same items, voxel count must not grow
+	for( int32 i=0; i<4; ++i )
+	{
+		tree.add( &i1, i1.mPos, i1.mRadius );
+		tree.add( &i2, i2.mPos, i2.mRadius );
+		tree.add( &i3, i3.mPos, i3.mRadius );
+		errorCheck( tree.getNumVoxels() == 1 + 8 + 8 );
+		
+		tree.remove( &i3 );
+		errorCheck( tree.getNumVoxels() == 1 + 8 );
+		
+		tree.remove( &i2 );
+		tree.remove( &i1 );
+		errorCheck( tree.getNumVoxels() == 1 );
+	}
+	
+	// clear releases everything at once
+	tree.add( &i1, i1.mPos, i1.mRadius );
+	tree.add( &i2, i2.mPos, i2.mRadius );
+	tree.add( &i3, i3.mPos, i3.mRadius );
+	tree.clear();
+	errorCheck( tree.getNumVoxels() == 1 );
+	errorCheck( tree.getNumItems() == 0 );
+	
+	// tree must be usable after a clear
+	tree.add( &i1, i1.mPos, i1.mRadius );
+	tree.add( &i2, i2.mPos, i2.mRadius );
+	errorCheck( tree.getNumVoxels() == 1 + 8 );
+	
+	std::set< OctItem* > items;
+	tree.getItems( vec3( 4, 4, 4 ), 2, items );
+	errorCheck( items.size() == 1 );
+	errorCheck( *(items.begin()) == &i1 );
+}
+
+// test several items sharing a leaf
+void testOctTreeLeafBucket()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	// large min voxel size, so nothing splits
+	octTree< OctItem* > tree( minSize, maxSize, 16 );
+	
+	std::vector< OctItem* > octItems;
+	for( int32 i=0; i<5; ++i )
+	{
+		OctItem* item = new OctItem( vec3( -6 + (i * 3), 0, 0 ), .5 );
+		octItems.push_back( item );
+		tree.add( item, item->mPos, item->mRadius );
+	}
+	
+	errorCheck( tree.getNumVoxels() == 1 );
+	
+	std::set< OctItem* > items;
+	tree.getItems( vec3( 0, 0, 0 ), 1, items );
+	errorCheck( items.size() == 1 );
+	errorCheck( *(items.begin()) == octItems[ 2 ] );
+	
+	items.clear();
+	tree.getItems( vec3( -8, 0, 0 ), vec3( 8, 0, 0 ), .1, items );
+	errorCheck( items.size() == 5 );
+	
+	// remove from the middle of the leaf
+	tree.remove( octItems[ 1 ] );
+	
+	items.clear();
+	tree.getItems( vec3( -8, 0, 0 ), vec3( 8, 0, 0 ), .1, items );
+	errorCheck( items.size() == 4 );
+	errorCheck( items.find( octItems[ 1 ] ) == items.end() );
+	
+	for( OctItem* item : octItems )
+	{
+		items.clear();
+		tree.getItems( item->mPos, item->mRadius, items );
+		errorCheck( items.size() == (item == octItems[ 1 ] ? 0 : 1) );
+	}
+	
+	tree.clear();
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+// test handle based access
+void testOctTreeHandles()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	octTree< OctItem* > tree( minSize, maxSize, 1 );
+	std::set< OctItem* > items;
+	std::vector< Box3 > voxels;
+	
+	OctItem i1( vec3( 2, 2, 2 ), 1 );
+	OctItem i2( vec3( -4, -4, -4 ), 1 );
+	
+	ItemHandle h1 = tree.add( &i1, i1.mPos, i1.mRadius );
+	ItemHandle h2 = tree.add( &i2, i2.mPos, i2.mRadius );
+	errorCheck( h1.valid() && h2.valid() );
+	errorCheck( h1 != h2 );
+	errorCheck( tree.getHandle( &i1 ) == h1 );
+	
+	voxels.clear();
+	errorCheck( tree.getVoxels( h2, voxels ) );
+	errorCheck( voxels.size() == 1 );
+	errorCheck( voxels[ 0 ] == Box3( vec3( -4, -4, -4 ), 4 ));
+	
+	// move i2 next to i1, handle must not change
+	errorCheck( tree.update( h2, vec3( 6, 6, 6 ), 1 ));
+	errorCheck( tree.getHandle( &i2 ) == h2 );
+	
+	items.clear();
+	tree.getItems( vec3( 6, 6, 6 ), 1, items );
+	errorCheck( items.size() == 1 );
+	errorCheck( *(items.begin()) == &i2 );
+	
+	items.clear();
+	tree.getItems( vec3( -4, -4, -4 ), 2, items );
+	errorCheck( items.size() == 0 );
+	
+	// remove by handle, handle becomes stale
+	errorCheck( tree.remove( h1 ));
+	errorCheck( tree.contains( h1 ) == false );
+	errorCheck( tree.remove( h1 ) == false );
+	errorCheck( tree.getHandle( &i1 ).valid() == false );
+	errorCheck( tree.getNumItems() == 1 );
+	
+	// reused slot gets a new generation
+	ItemHandle h3 = tree.add( &i1, i1.mPos, i1.mRadius );
+	errorCheck( h3.mIndex == h1.mIndex );
+	errorCheck( h3 != h1 );
+	errorCheck( tree.contains( h3 ));
+	
+	// clear invalidates all handles
+	tree.clear();
+	errorCheck( tree.contains( h2 ) == false );
+	errorCheck( tree.contains( h3 ) == false );
+	
+	// handle only tree, item type doesn't need hashing
+	class OctId
+	{
+	public:
+		int32 mId;
+	};
+	
+	octTree< OctId, NoItemIndex< OctId > > tree2( minSize, maxSize, 1 );
+	ItemHandle h4 = tree2.add( OctId{ 1 }, i1.mPos, i1.mRadius );
+	ItemHandle h5 = tree2.add( OctId{ 2 }, i2.mPos, i2.mRadius );
+	errorCheck( tree2.getNumItems() == 2 );
+	
+	voxels.clear();
+	tree2.getVoxels( h4, voxels );
+	errorCheck( voxels.size() == 1 );
+	errorCheck( voxels[ 0 ] == Box3( vec3( 4, 4, 4 ), 4 ));
+	
+	errorCheck( tree2.remove( h5 ));
+	errorCheck( tree2.remove( h4 ));
+	errorCheck( tree2.getNumItems() == 0 );
+	errorCheck( tree2.getNumVoxels() == 1 );
+}
+
+// compare load and query times of tree backends
+template< typename TTree >
+void benchOctTree( const char* name, int32 splitThreshold )
+{
+	vec3 minSize( -64, -64, -64 );
+	vec3 maxSize( 64, 64, 64 );
+	TTree tree( minSize, maxSize, 1, splitThreshold );
+	
+	srand( 1 );
+	std::vector< OctItem* > octItems;
+	for( int32 i=0; i<20000; ++i )
+	{
+		vec3 p( randFloat( -63, 63 ), randFloat( -63, 63 ), randFloat( -63, 63 ));
+		octItems.push_back( new OctItem( p, randFloat( .1, .5 )));
+	}
+	
+	float64 startTime = getTimer();
+	for( OctItem* item : octItems )
+	{
+		tree.add( item, item->mPos, item->mRadius );
+	}
+	float64 loadTime = getTimer() - startTime;
+	
+	std::set< OctItem* > items;
+	size_t numFound = 0;
+	startTime = getTimer();
+	for( int32 i=0; i<20000; ++i )
+	{
+		vec3 p( randFloat( -60, 60 ), randFloat( -60, 60 ), randFloat( -60, 60 ));
+		items.clear();
+		tree.getItems( p, 2, items );
+		numFound += items.size();
+		
+		items.clear();
+		tree.getItems( p, p + vec3( 4, 2, 1 ), .5, items );
+		numFound += items.size();
+	}
+	float64 queryTime = getTimer() - startTime;
+	
+	printf( "%s: voxels %d, load %.3fs, query %.3fs (%d found)\n", name,
+		static_cast< int32 >( tree.getNumVoxels() ), loadTime, queryTime, static_cast< int32 >( numFound ));
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+// test bulk build matches adding items one at a time
+void testOctTreeBuild()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	octTree< OctItem* > tree( minSize, maxSize, 1 );
+	octTree< OctItem* > tree2( minSize, maxSize, 1 );
+	
+	// empty build
+	std::vector< BuildItem< OctItem* > > buildItems;
+	tree.build( buildItems );
+	errorCheck( tree.getNumItems() == 0 );
+	errorCheck( tree.getNumVoxels() == 1 );
+	
+	srand( 2 );
+	std::vector< OctItem* > octItems;
+	for( int32 i=0; i<2000; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		OctItem* item = new OctItem( p, randFloat( .05, .5 ));
+		octItems.push_back( item );
+		buildItems.push_back( BuildItem< OctItem* >( item, item->mPos, item->mRadius ));
+		tree2.add( item, item->mPos, item->mRadius );
+	}
+	
+	std::vector< ItemHandle > handles;
+	tree.build( buildItems, &handles );
+	errorCheck( tree.getNumItems() == octItems.size() );
+	errorCheck( handles.size() == octItems.size() );
+	errorCheck( tree.getHandle( octItems[ 10 ] ) == handles[ 10 ] );
+	
+	// same query results as the incremental tree
+	std::set< OctItem* > items;
+	std::set< OctItem* > items2;
+	for( int32 i=0; i<200; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		items.clear();
+		items2.clear();
+		tree.getItems( p, 1, items );
+		tree2.getItems( p, 1, items2 );
+		errorCheck( items == items2 );
+		
+		items.clear();
+		items2.clear();
+		tree.getItems( p, -1 * p, .1, items );
+		tree2.getItems( p, -1 * p, .1, items2 );
+		errorCheck( items == items2 );
+	}
+	
+	// built tree must support removes
+	for( OctItem* item : octItems )
+	{
+		tree.remove( item );
+		tree2.remove( item );
+	}
+	
+	errorCheck( tree.getNumItems() == 0 );
+	errorCheck( tree.getNumVoxels() == 1 );
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+// parallel build must make the same tree for any thread count
+void testOctTreeBuildParallel()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	srand( 3 );
+	std::vector< OctItem* > octItems;
+	std::vector< BuildItem< OctItem* > > buildItems;
+	for( int32 i=0; i<5000; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		OctItem* item = new OctItem( p, randFloat( .05, .5 ));
+		octItems.push_back( item );
+		buildItems.push_back( BuildItem< OctItem* >( item, item->mPos, item->mRadius ));
+	}
+	
+	octTree< OctItem* > tree( minSize, maxSize, .25 );
+	tree.build( buildItems );
+	
+	Box3 maxBox( kOrigin3, 8 );
+	std::vector< Box3 > voxels;
+	tree.getVoxels( maxBox, voxels );
+	
+	int32 numThreads[] = { 1, 2, 4, 8 };
+	for( int32 n : numThreads )
+	{
+		ThreadPool pool( n );
+		octTree< OctItem* > tree2( minSize, maxSize, .25 );
+		
+		// twice, the second time into a used arena
+		for( int32 pass=0; pass<2; ++pass )
+		{
+			std::vector< ItemHandle > handles;
+			tree2.buildParallel( buildItems, pool, &handles, 64 );
+			errorCheck( tree2.getNumItems() == octItems.size() );
+			errorCheck( tree2.getNumVoxels() == tree.getNumVoxels() );
+			errorCheck( handles.size() == octItems.size() );
+			
+			std::vector< Box3 > voxels2;
+			tree2.getVoxels( maxBox, voxels2 );
+			errorCheck( voxels == voxels2 );
+			
+			for( size_t i=0; i<octItems.size(); ++i )
+			{
+				std::vector< Box3 > itemVoxels;
+				std::vector< Box3 > itemVoxels2;
+				tree.getVoxels( octItems[ i ], itemVoxels );
+				tree2.getVoxels( handles[ i ], itemVoxels2 );
+				errorCheck( itemVoxels == itemVoxels2 );
+			}
+		}
+		
+		// built tree must support removes
+		for( OctItem* item : octItems )
+		{
+			tree2.remove( item );
+		}
+		
+		errorCheck( tree2.getNumVoxels() == 1 );
+	}
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+void testOctTreeForEach()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	octTree< OctItem* > tree( minSize, maxSize, .25 );
+	
+	srand( 4 );
+	std::vector< OctItem* > octItems;
+	for( int32 i=0; i<2000; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		OctItem* item = new OctItem( p, randFloat( .05, .5 ));
+		octItems.push_back( item );
+		tree.add( item, item->mPos, item->mRadius );
+	}
+	
+	// same items as getItems()
+	std::set< OctItem* > items;
+	std::set< OctItem* > items2;
+	for( int32 i=0; i<200; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		items.clear();
+		items2.clear();
+		tree.getItems( p, 1, items );
+		bool finished = tree.forEachItem( Box3( p, 1 ), [&items2]( OctItem* item )
+		{
+			items2.insert( item );
+			return( true );
+		} );
+		errorCheck( finished );
+		errorCheck( items == items2 );
+		
+		items.clear();
+		items2.clear();
+		tree.getItems( p, -1 * p, .1, items );
+		tree.forEachItem( p, -1 * p, .1, [&items2]( OctItem* item )
+		{
+			items2.insert( item );
+			return( true );
+		} );
+		errorCheck( items == items2 );
+	}
+	
+	// stop after the first item
+	int32 numVisited = 0;
+	bool finished = tree.forEachItem( Box3( kOrigin3, 8 ), [&numVisited]( OctItem* )
+	{
+		numVisited++;
+		return( false );
+	} );
+	errorCheck( finished == false );
+	errorCheck( numVisited == 1 );
+	
+	numVisited = 0;
+	finished = tree.forEachItem( vec3( -7, -7, -7 ), vec3( 7, 7, 7 ), 1, [&numVisited]( OctItem* )
+	{
+		numVisited++;
+		return( numVisited < 3 );
+	} );
+	errorCheck( finished == false );
+	errorCheck( numVisited == 3 );
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+// items in several voxels must only be reported once
+void testOctTreeMailbox()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	// small voxels and large items, so most items are in several leafs
+	octTree< OctItem* > tree( minSize, maxSize, .25 );
+	
+	srand( 5 );
+	std::vector< OctItem* > octItems;
+	for( int32 i=0; i<1000; ++i )
+	{
+		vec3 p( randFloat( -6, 6 ), randFloat( -6, 6 ), randFloat( -6, 6 ));
+		OctItem* item = new OctItem( p, randFloat( .5, 1.5 ));
+		octItems.push_back( item );
+		tree.add( item, item->mPos, item->mRadius );
+	}
+	
+	QueryMailbox mailbox;
+	std::set< OctItem* > items;
+	std::vector< OctItem* > items2;
+	for( int32 i=0; i<200; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		items.clear();
+		items2.clear();
+		tree.getItems( p, 2, items );
+		tree.getItems( p, 2, items2 );
+		errorCheck( items.size() == items2.size() );
+		errorCheck( items == std::set< OctItem* >( items2.begin(), items2.end() ));
+		
+		items.clear();
+		items2.clear();
+		tree.getItems( p, -1 * p, .5, items );
+		tree.forEachItem( p, -1 * p, .5, mailbox, [&items2]( OctItem* item )
+		{
+			items2.push_back( item );
+			return( true );
+		} );
+		errorCheck( items.size() == items2.size() );
+		errorCheck( items == std::set< OctItem* >( items2.begin(), items2.end() ));
+	}
+	
+	// a query from another query's callback gets its own mailbox
+	items.clear();
+	tree.getItems( kOrigin3, 2, items );
+	size_t numVisited = 0;
+	tree.forEachItem( Box3( kOrigin3, 2 ), [&tree, &numVisited]( OctItem* item )
+	{
+		std::vector< OctItem* > inner;
+		tree.getItems( item->mPos, .1, inner );
+		errorCheck( std::find( inner.begin(), inner.end(), item ) != inner.end() );
+		numVisited++;
+		return( true );
+	} );
+	errorCheck( numVisited == items.size() );
+	
+	// const queries from several threads at once
+	auto countItems = [&tree]()
+	{
+		size_t count = 0;
+		std::vector< OctItem* > found;
+		for( int32 i=0; i<200; ++i )
+		{
+			vec3 p( (i % 13) - 6, (i % 7) - 3, (i % 5) - 2 );
+			found.clear();
+			tree.getItems( p, 2, found );
+			count += found.size();
+		}
+		
+		return( count );
+	};
+	
+	size_t expected = countItems();
+	std::vector< size_t > counts( 4, 0 );
+	std::vector< std::thread > threads;
+	for( size_t i=0; i<counts.size(); ++i )
+	{
+		threads.push_back( std::thread( [&counts, &countItems, i]()
+		{
+			counts[ i ] = countItems();
+		} ));
+	}
+	
+	for( size_t i=0; i<threads.size(); ++i )
+	{
+		threads[ i ].join();
+		errorCheck( counts[ i ] == expected );
+	}
+	
+	// removes and adds reuse handle slots
+	for( int32 i=0; i<500; ++i )
+	{
+		tree.remove( octItems[ i ] );
+	}
+	
+	for( int32 i=0; i<250; ++i )
+	{
+		tree.add( octItems[ i ], octItems[ i ]->mPos, octItems[ i ]->mRadius );
+	}
+	
+	items.clear();
+	items2.clear();
+	tree.getItems( kOrigin3, 8, items );
+	tree.getItems( kOrigin3, 8, items2 );
+	errorCheck( items.size() == 750 );
+	errorCheck( items2.size() == 750 );
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+void testOctTreeNearest()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	octTree< OctItem* > tree( minSize, maxSize, .25 );
+	
+	std::vector< OctItem* > out;
+	std::vector< float64 > dists;
+	tree.getNearest( kOrigin3, 5, 100, out );
+	errorCheck( out.size() == 0 );
+	
+	srand( 6 );
+	std::vector< OctItem* > octItems;
+	for( int32 i=0; i<2000; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		OctItem* item = new OctItem( p, randFloat( .05, .5 ));
+		octItems.push_back( item );
+		tree.add( item, item->mPos, item->mRadius );
+	}
+	
+	for( int32 i=0; i<100; ++i )
+	{
+		vec3 p( randFloat( -8, 8 ), randFloat( -8, 8 ), randFloat( -8, 8 ));
+		size_t k = 1 + (i % 20);
+		float64 maxDist = (i % 2 == 0) ? 100 : .5;
+		
+		// brute force surface distances
+		std::vector< float64 > allDists;
+		for( OctItem* item : octItems )
+		{
+			float64 dist = std::max( lengthVec( item->mPos - p ) - item->mRadius, 0.0 );
+			if (dist <= maxDist)
+			{
+				allDists.push_back( dist );
+			}
+		}
+		
+		std::sort( allDists.begin(), allDists.end() );
+		allDists.resize( std::min( k, allDists.size() ));
+		
+		out.clear();
+		dists.clear();
+		tree.getNearest( p, k, maxDist, out, &dists );
+		errorCheck( out.size() == allDists.size() );
+		errorCheck( dists.size() == allDists.size() );
+		for( size_t j=0; j<dists.size(); ++j )
+		{
+			errorCheck( fabs( dists[ j ] - allDists[ j ] ) < .000001 );
+			
+			float64 dist = std::max( lengthVec( out[ j ]->mPos - p ) - out[ j ]->mRadius, 0.0 );
+			errorCheck( fabs( dist - dists[ j ] ) < .000001 );
+		}
+		
+		// each item once
+		errorCheck( std::set< OctItem* >( out.begin(), out.end() ).size() == out.size() );
+	}
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+void testOctTreePolytope()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	octTree< OctItem* > tree( minSize, maxSize, .25 );
+	
+	srand( 7 );
+	std::vector< OctItem* > octItems;
+	for( int32 i=0; i<3000; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		OctItem* item = new OctItem( p, randFloat( .05, .5 ));
+		octItems.push_back( item );
+		tree.add( item, item->mPos, item->mRadius );
+	}
+	
+	std::vector< OctItem* > out;
+	for( int32 i=0; i<50; ++i )
+	{
+		// random planes facing a point near the origin
+		vec3 center( randFloat( -2, 2 ), randFloat( -2, 2 ), randFloat( -2, 2 ));
+		std::vector< Plane > planes;
+		for( int32 j=0; j<8; ++j )
+		{
+			vec3 dir( randFloat( -1, 1 ), randFloat( -1, 1 ), randFloat( -1, 1 ));
+			dir = normalizeVec( dir );
+			planes.push_back( Plane( center + dir * randFloat( 1, 5 ), -1 * dir ));
+		}
+		
+		out.clear();
+		tree.getItems( planes.data(), static_cast< int32 >( planes.size() ), out );
+		std::set< OctItem* > found( out.begin(), out.end() );
+		errorCheck( found.size() == out.size() );
+		
+		for( OctItem* item : octItems )
+		{
+			Box3 box( item->mPos, item->mRadius );
+			bool centerInside = true;
+			bool boxCrosses = true;
+			for( const Plane& plane : planes )
+			{
+				centerInside = centerInside && plane.dist( item->mPos ) > 0;
+				boxCrosses = boxCrosses && box.classify( plane ) >= 0;
+			}
+			
+			// items with the center inside must be found, and nothing
+			// found can be fully outside a plane
+			if (centerInside)
+			{
+				errorCheck( found.count( item ) == 1 );
+			}
+			
+			if (found.count( item ) == 1)
+			{
+				errorCheck( boxCrosses );
+			}
+		}
+	}
+	
+	// item crossing a leaf fully inside and a cut leaf before it. its
+	// sphere misses the plane but its box reaches the inside leaf
+	{
+		octTree< OctItem* > small( minSize, maxSize, .25 );
+		std::vector< OctItem > fill;
+		fill.reserve( 512 );
+		for( int32 x=-4; x<4; ++x )
+		{
+			for( int32 y=-4; y<4; ++y )
+			{
+				for( int32 z=-4; z<4; ++z )
+				{
+					// one per .25 voxel around the origin, so they split
+					fill.push_back( OctItem( vec3( x + .5f, y + .5f, z + .5f ) * .25f, .01 ));
+					small.add( &fill.back(), fill.back().mPos, fill.back().mRadius );
+				}
+			}
+		}
+		
+		OctItem spanning( vec3( -.35f, -.35f, .1f ), .4 );
+		small.add( &spanning, spanning.mPos, spanning.mRadius );
+		
+		Plane plane( vec3( -.05f, -.05f, 0 ), normalizeVec( vec3( 1, 1, 0 )));
+		errorCheck( plane.dist( spanning.mPos ) < -spanning.mRadius );
+		
+		out.clear();
+		small.getItems( &plane, 1, out );
+		errorCheck( std::count( out.begin(), out.end(), &spanning ) == 1 );
+	}
+	
+	// frustum looking down -z from z = 6
+	vec3 eye( 0, 0, 6 );
+	Frustum frustum( Plane( eye, vec3( 1, 0, -1 )), Plane( eye, vec3( -1, 0, -1 )),
+		Plane( eye, vec3( 0, -1, -1 )), Plane( eye, vec3( 0, 1, -1 )));
+	
+	out.clear();
+	tree.getItems( frustum, out );
+	std::set< OctItem* > found( out.begin(), out.end() );
+	for( OctItem* item : octItems )
+	{
+		if (frustum.dist( item->mPos ) > 0)
+		{
+			errorCheck( found.count( item ) == 1 );
+		}
+		
+		if (found.count( item ) == 1)
+		{
+			errorCheck( frustum.dist( item->mPos ) >= -item->mRadius * 2 );
+		}
+	}
+	
+	// nothing on the far side of the eye
+	for( OctItem* item : out )
+	{
+		errorCheck( item->mPos.mZ - item->mRadius * 2 < 6 );
+	}
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+void testOctTreeRaycast()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	octTree< OctItem* > tree( minSize, maxSize, .25 );
+	
+	OctItem* hit = nullptr;
+	float64 t = -1;
+	errorCheck( tree.raycastFirst( vec3( -7, 0, 0 ), vec3( 7, 0, 0 ), .1, hit, t ) == false );
+	
+	srand( 8 );
+	std::vector< OctItem* > octItems;
+	for( int32 i=0; i<2000; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		OctItem* item = new OctItem( p, randFloat( .05, .5 ));
+		octItems.push_back( item );
+		tree.add( item, item->mPos, item->mRadius );
+	}
+	
+	QueryMailbox mailbox;
+	for( int32 i=0; i<300; ++i )
+	{
+		vec3 p1( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		vec3 p2( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		float64 radius = (i % 3 == 0) ? 0 : .1;
+		
+		// closest of everything the beam query finds
+		std::vector< OctItem* > items;
+		tree.getItems( p1, p2, radius, items );
+		float64 bestT = -1;
+		for( OctItem* item : items )
+		{
+			float64 t2 = getCollision( p1, p2 - p1, item->mPos, radius + item->mRadius );
+			if (bestT < 0 || t2 < bestT)
+			{
+				bestT = t2;
+			}
+		}
+		
+		hit = nullptr;
+		bool found = tree.raycastFirst( p1, p2, radius, hit, t );
+		errorCheck( found == (items.size() > 0) );
+		if (found)
+		{
+			errorCheck( t == bestT );
+			errorCheck( getCollision( p1, p2 - p1, hit->mPos, radius + hit->mRadius ) == t );
+			
+			// same hit with the caller's mailbox
+			OctItem* hit2 = nullptr;
+			float64 t2 = -1;
+			errorCheck( tree.raycastFirst( p1, p2, radius, mailbox, hit2, t2 ));
+			errorCheck( t2 == t );
+		}
+	}
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+// item voxels must be exactly the leafs its box touches
+template< typename TTree >
+void verifyItemVoxels( const TTree& tree, const vec3& p, float64 radius, ItemHandle handle )
+{
+	std::vector< Box3 > itemVoxels;
+	std::vector< Box3 > leafs;
+	tree.getVoxels( handle, itemVoxels );
+	tree.getVoxels( Box3( p, radius ), leafs );
+	errorCheck( itemVoxels.size() == leafs.size() );
+	errorCheck( verifyVoxels( itemVoxels, leafs ));
+}
+
+void testOctTreeUpdate()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	octTree< OctItem* > tree( minSize, maxSize, .25 );
+	
+	srand( 9 );
+	std::vector< OctItem* > octItems;
+	for( int32 i=0; i<1000; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		OctItem* item = new OctItem( p, randFloat( .05, .5 ));
+		octItems.push_back( item );
+		tree.add( item, item->mPos, item->mRadius );
+	}
+	
+	for( int32 tick=0; tick<20; ++tick )
+	{
+		// mostly small moves, some jumps
+		for( OctItem* item : octItems )
+		{
+			float32 step = (rand() % 10 == 0) ? 3 : .05;
+			vec3 p = item->mPos + vec3( randFloat( -step, step ), randFloat( -step, step ), randFloat( -step, step ));
+			for( int32 j=0; j<3; ++j )
+			{
+				p[ j ] = std::max( -7.0f, std::min( 7.0f, p[ j ] ));
+			}
+			
+			item->mPos = p;
+			bool updated = tree.update( item, item->mPos, item->mRadius );
+			errorCheck( updated );
+		}
+		
+		for( OctItem* item : octItems )
+		{
+			verifyItemVoxels( tree, item->mPos, item->mRadius, tree.getHandle( item ));
+		}
+		
+		// same results as a tree made from scratch
+		octTree< OctItem* > tree2( minSize, maxSize, .25 );
+		for( OctItem* item : octItems )
+		{
+			tree2.add( item, item->mPos, item->mRadius );
+		}
+		
+		for( int32 i=0; i<20; ++i )
+		{
+			vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+			std::set< OctItem* > items;
+			std::set< OctItem* > items2;
+			tree.getItems( p, 1, items );
+			tree2.getItems( p, 1, items2 );
+			errorCheck( items == items2 );
+		}
+	}
+	
+	// stale handle
+	ItemHandle handle = tree.getHandle( octItems[ 0 ] );
+	tree.remove( octItems[ 0 ] );
+	errorCheck( tree.update( handle, kOrigin3, 1 ) == false );
+	
+	for( size_t i=1; i<octItems.size(); ++i )
+	{
+		tree.remove( octItems[ i ] );
+	}
+	
+	errorCheck( tree.getNumVoxels() == 1 );
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+void testOctTreeUpdateMany()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	octTree< OctItem* > tree( minSize, maxSize, .25 );
+	
+	srand( 10 );
+	std::vector< OctItem* > octItems;
+	for( int32 i=0; i<2000; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		OctItem* item = new OctItem( p, randFloat( .05, .5 ));
+		octItems.push_back( item );
+		tree.add( item, item->mPos, item->mRadius );
+	}
+	
+	std::vector< BuildItem< OctItem* > > moves;
+	for( int32 tick=0; tick<20; ++tick )
+	{
+		// most items move a little, a few jump or change size
+		moves.clear();
+		for( OctItem* item : octItems )
+		{
+			if (rand() % 5 == 0)
+			{
+				continue;
+			}
+			
+			float32 step = (rand() % 20 == 0) ? 4 : .05;
+			vec3 p = item->mPos + vec3( randFloat( -step, step ), randFloat( -step, step ), randFloat( -step, step ));
+			for( int32 j=0; j<3; ++j )
+			{
+				p[ j ] = std::max( -7.0f, std::min( 7.0f, p[ j ] ));
+			}
+			
+			item->mPos = p;
+			if (rand() % 50 == 0)
+			{
+				item->mRadius = randFloat( .05, .9 );
+			}
+			
+			moves.push_back( BuildItem< OctItem* >( item, item->mPos, item->mRadius ));
+		}
+		
+		tree.updateMany( moves );
+		errorCheck( tree.getNumItems() == octItems.size() );
+		
+		for( OctItem* item : octItems )
+		{
+			verifyItemVoxels( tree, item->mPos, item->mRadius, tree.getHandle( item ));
+		}
+		
+		// same results as a tree made from scratch
+		octTree< OctItem* > tree2( minSize, maxSize, .25 );
+		for( OctItem* item : octItems )
+		{
+			tree2.add( item, item->mPos, item->mRadius );
+		}
+		
+		for( int32 i=0; i<20; ++i )
+		{
+			vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+			std::set< OctItem* > items;
+			std::set< OctItem* > items2;
+			tree.getItems( p, 1, items );
+			tree2.getItems( p, 1, items2 );
+			errorCheck( items == items2 );
+		}
+	}
+	
+	// everything into one corner and back out, forces combines and splits
+	moves.clear();
+	for( OctItem* item : octItems )
+	{
+		moves.push_back( BuildItem< OctItem* >( item, vec3( 7, 7, 7 ), .01 ));
+	}
+	
+	tree.updateMany( moves );
+	for( OctItem* item : octItems )
+	{
+		verifyItemVoxels( tree, vec3( 7, 7, 7 ), .01, tree.getHandle( item ));
+	}
+	
+	moves.clear();
+	for( OctItem* item : octItems )
+	{
+		moves.push_back( BuildItem< OctItem* >( item, item->mPos, item->mRadius ));
+	}
+	
+	tree.updateMany( moves );
+	for( OctItem* item : octItems )
+	{
+		verifyItemVoxels( tree, item->mPos, item->mRadius, tree.getHandle( item ));
+	}
+	
+	for( OctItem* item : octItems )
+	{
+		tree.remove( item );
+	}
+	
+	errorCheck( tree.getNumVoxels() == 1 );
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+template< typename TPolicy >
+void testOctTreeSplitPolicy( int32 splitThreshold )
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	float64 minVoxelSize = .25;
+	
+	octTree< OctItem*, HashItemIndex< OctItem* >, TPolicy > tree( minSize, maxSize, minVoxelSize, splitThreshold );
+	octTree< OctItem* > tree2( minSize, maxSize, minVoxelSize );
+	linearOctTree< OctItem*, HashItemIndex< OctItem* >, TPolicy > linearTree( minSize, maxSize,
+		minVoxelSize, splitThreshold );
+	
+	srand( 11 );
+	std::vector< OctItem* > octItems;
+	for( int32 i=0; i<2000; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		OctItem* item = new OctItem( p, randFloat( .05, .5 ));
+		octItems.push_back( item );
+		tree.add( item, item->mPos, item->mRadius );
+		tree2.add( item, item->mPos, item->mRadius );
+		linearTree.add( item, item->mPos, item->mRadius );
+	}
+	
+	// bigger buckets, fewer voxels
+	errorCheck( tree.getNumVoxels() < tree2.getNumVoxels() );
+	
+	// the linear backend splits by the same policy
+	errorCheck( linearTree.getNumVoxels() == tree.getNumVoxels() );
+	
+	// capacity leafs only go over the threshold at the smallest size
+	// hybrid leafs can also stay over it when the items are too close
+	bool capped = std::is_same< TPolicy, CapacitySplitPolicy >::value;
+	Box3 maxBox( kOrigin3, 8 );
+	std::vector< Box3 > leafs;
+	tree.getVoxels( maxBox, leafs );
+	for( const Box3& leaf : leafs )
+	{
+		std::vector< OctItem* > items;
+		tree.getItems( leaf.getCenter(), leaf.getSize().mX / 2, items );
+		errorCheck( capped == false
+			|| items.size() <= static_cast< size_t >( splitThreshold )
+			|| leaf.getSize().mX <= minVoxelSize );
+	}
+	
+	// same results as the default policy
+	for( int32 i=0; i<200; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		std::set< OctItem* > items;
+		std::set< OctItem* > items2;
+		tree.getItems( p, 1, items );
+		tree2.getItems( p, 1, items2 );
+		errorCheck( items == items2 );
+		
+		items2.clear();
+		linearTree.getItems( p, 1, items2 );
+		errorCheck( items == items2 );
+		
+		items.clear();
+		items2.clear();
+		tree.getItems( p, -1 * p, .1, items );
+		tree2.getItems( p, -1 * p, .1, items2 );
+		errorCheck( items == items2 );
+	}
+	
+	// moves and removes work with any policy
+	for( OctItem* item : octItems )
+	{
+		item->mPos = item->mPos * .5;
+		tree.update( item, item->mPos, item->mRadius );
+		verifyItemVoxels( tree, item->mPos, item->mRadius, tree.getHandle( item ));
+	}
+	
+	for( OctItem* item : octItems )
+	{
+		tree.remove( item );
+	}
+	
+	errorCheck( tree.getNumVoxels() == 1 );
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+void testOctTreeHysteresis()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	typedef octTree< OctItem*, HashItemIndex< OctItem* >, CapacitySplitPolicy > CapacityTree;
+	
+	// a 5th item goes over the capacity of 4 and back
+	std::vector< OctItem* > octItems;
+	octItems.push_back( new OctItem( vec3( -4, -4, -4 ), .1 ));
+	octItems.push_back( new OctItem( vec3( -4, 4, -4 ), .1 ));
+	octItems.push_back( new OctItem( vec3( 4, -4, 4 ), .1 ));
+	octItems.push_back( new OctItem( vec3( -4, -4, 4 ), .1 ));
+	OctItem mover( vec3( 4, 4, 4 ), .1 );
+	
+	// the root splits once, and stays split while the mover comes and goes
+	CapacityTree tree( minSize, maxSize, .25, 4 );
+	for( OctItem* item : octItems )
+	{
+		tree.add( item, item->mPos, item->mRadius );
+	}
+	
+	errorCheck( tree.getNumVoxels() == 1 );
+	for( int32 i=0; i<4; ++i )
+	{
+		tree.add( &mover, mover.mPos, mover.mRadius );
+		errorCheck( tree.getNumVoxels() == 9 );
+		tree.remove( &mover );
+		errorCheck( tree.getNumVoxels() == 9 );
+	}
+	
+	// default merge threshold is 1
+	tree.remove( octItems[ 0 ] );
+	tree.remove( octItems[ 1 ] );
+	errorCheck( tree.getNumVoxels() == 9 );
+	tree.remove( octItems[ 2 ] );
+	errorCheck( tree.getNumVoxels() == 1 );
+	
+	// merge at 2, children live at least 3 ticks
+	CapacityTree tree2( minSize, maxSize, .25, 4 );
+	tree2.setCombineRules( 2, 3, false );
+	for( OctItem* item : octItems )
+	{
+		tree2.add( item, item->mPos, item->mRadius );
+	}
+	
+	tree2.add( &mover, mover.mPos, mover.mRadius );
+	errorCheck( tree2.getNumVoxels() == 9 );
+	tree2.remove( octItems[ 0 ] );
+	tree2.remove( octItems[ 1 ] );
+	tree2.remove( octItems[ 2 ] );
+	
+	// too young
+	errorCheck( tree2.getNumVoxels() == 9 );
+	tree2.tick();
+	tree2.tick();
+	tree2.tick();
+	
+	// old enough, combined on the next remove
+	tree2.remove( &mover );
+	errorCheck( tree2.getNumVoxels() == 1 );
+	errorCheck( tree2.getNumItems() == 1 );
+	
+	// deferred, only combine() combines
+	CapacityTree tree3( minSize, maxSize, .25, 4 );
+	tree3.setCombineRules( 2, 0, true );
+	for( OctItem* item : octItems )
+	{
+		tree3.add( item, item->mPos, item->mRadius );
+	}
+	
+	tree3.add( &mover, mover.mPos, mover.mRadius );
+	for( OctItem* item : octItems )
+	{
+		tree3.remove( item );
+	}
+	
+	errorCheck( tree3.getNumVoxels() == 9 );
+	std::set< OctItem* > items;
+	tree3.getItems( kOrigin3, 8, items );
+	errorCheck( items.size() == 1 && items.count( &mover ) == 1 );
+	
+	tree3.combine();
+	errorCheck( tree3.getNumVoxels() == 1 );
+	items.clear();
+	tree3.getItems( kOrigin3, 8, items );
+	errorCheck( items.size() == 1 && items.count( &mover ) == 1 );
+	verifyItemVoxels( tree3, mover.mPos, mover.mRadius, tree3.getHandle( &mover ));
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+// loose tree finds the same items as octTree, with one node per item
+void testOctTreeLoose()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	looseOctTree< OctItem* > tree( minSize, maxSize, .25, 2, 4 );
+	
+	// item on the split planes stays at the root
+	OctItem center( kOrigin3, 1 );
+	ItemHandle centerHandle = tree.add( &center, center.mPos, center.mRadius );
+	
+	srand( 16 );
+	std::vector< OctItem* > octItems;
+	for( int32 i=0; i<1000; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		OctItem* item = new OctItem( p, randFloat( .05, .5 ));
+		octItems.push_back( item );
+		tree.add( item, item->mPos, item->mRadius );
+	}
+	
+	errorCheck( tree.getNumItems() == octItems.size() + 1 );
+	errorCheck( tree.getNumVoxels() > 1 );
+	
+	Box3 centerVoxel;
+	errorCheck( tree.getVoxel( centerHandle, centerVoxel ));
+	errorCheck( centerVoxel.contains( Box3( center.mPos, center.mRadius )));
+	
+	for( int32 tick=0; tick<10; ++tick )
+	{
+		for( OctItem* item : octItems )
+		{
+			float32 step = (rand() % 10 == 0) ? 3 : .05;
+			vec3 p = item->mPos + vec3( randFloat( -step, step ), randFloat( -step, step ), randFloat( -step, step ));
+			for( int32 j=0; j<3; ++j )
+			{
+				p[ j ] = std::max( -7.0f, std::min( 7.0f, p[ j ] ));
+			}
+			
+			item->mPos = p;
+			bool updated = tree.update( item, item->mPos, item->mRadius );
+			errorCheck( updated );
+		}
+		
+		// node of every item holds its box
+		for( OctItem* item : octItems )
+		{
+			Box3 voxel;
+			errorCheck( tree.getVoxel( tree.getHandle( item ), voxel ));
+			errorCheck( voxel.contains( Box3( item->mPos, item->mRadius )));
+		}
+		
+		octTree< OctItem* > tree2( minSize, maxSize, .25 );
+		tree2.add( &center, center.mPos, center.mRadius );
+		for( OctItem* item : octItems )
+		{
+			tree2.add( item, item->mPos, item->mRadius );
+		}
+		
+		for( int32 i=0; i<20; ++i )
+		{
+			vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+			std::vector< OctItem* > items;
+			std::set< OctItem* > items2;
+			tree.getItems( p, 1, items );
+			tree2.getItems( p, 1, items2 );
+			
+			// no duplicates without a mailbox
+			std::set< OctItem* > itemSet( items.begin(), items.end() );
+			errorCheck( itemSet.size() == items.size() );
+			errorCheck( itemSet == items2 );
+			
+			vec3 p2( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+			items.clear();
+			items2.clear();
+			tree.getItems( p, p2, .25, items );
+			tree2.getItems( p, p2, .25, items2 );
+			itemSet = std::set< OctItem* >( items.begin(), items.end() );
+			errorCheck( itemSet.size() == items.size() );
+			errorCheck( itemSet == items2 );
+			
+			// point beam inside an item
+			OctItem* inside = octItems[ rand() % octItems.size() ];
+			items.clear();
+			items2.clear();
+			tree.getItems( inside->mPos, inside->mPos, .1, items );
+			tree2.getItems( inside->mPos, inside->mPos, .1, items2 );
+			itemSet = std::set< OctItem* >( items.begin(), items.end() );
+			errorCheck( itemSet.count( inside ) == 1 );
+			errorCheck( itemSet == items2 );
+		}
+	}
+	
+	// early exit
+	int32 numVisited = 0;
+	tree.forEachItem( Box3( kOrigin3, 8 ), [&numVisited]( OctItem* )
+	{
+		++numVisited;
+		return( numVisited < 3 );
+	} );
+	errorCheck( numVisited == 3 );
+	
+	// stale handle
+	ItemHandle handle = tree.getHandle( octItems[ 0 ] );
+	tree.remove( octItems[ 0 ] );
+	errorCheck( tree.update( handle, kOrigin3, 1 ) == false );
+	errorCheck( tree.contains( handle ) == false );
+	
+	for( size_t i=1; i<octItems.size(); ++i )
+	{
+		tree.remove( octItems[ i ] );
+	}
+	tree.remove( &center );
+	
+	errorCheck( tree.getNumItems() == 0 );
+	errorCheck( tree.getNumVoxels() == 1 );
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+// every overlapping pair once, from all trees and the parallel walk
+void testOctTreePairs()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	typedef std::pair< OctItem*, OctItem* > ItemPair;
+	
+	std::vector< OctItem* > octItems;
+	
+	// on the split planes and against the max side of the root
+	octItems.push_back( new OctItem( kOrigin3, 1 ));
+	octItems.push_back( new OctItem( vec3( .5, .5, .5 ), .25 ));
+	octItems.push_back( new OctItem( vec3( 7.5, 7.5, 7.5 ), .5 ));
+	octItems.push_back( new OctItem( vec3( 7.75, 7.75, 7.75 ), .25 ));
+	
+	srand( 17 );
+	for( int32 i=0; i<1500; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		
+		// some clumps
+		if (i % 3 == 0)
+		{
+			p = vec3( randFloat( 2, 3 ), randFloat( -3, -2 ), randFloat( 2, 3 ));
+		}
+		
+		octItems.push_back( new OctItem( p, randFloat( .05, .5 )));
+	}
+	
+	std::set< ItemPair > pairs;
+	for( size_t i=0; i<octItems.size(); ++i )
+	{
+		for( size_t j=i+1; j<octItems.size(); ++j )
+		{
+			OctItem* a = octItems[ i ];
+			OctItem* b = octItems[ j ];
+			if (spheresOverlap( a->mPos, a->mRadius, b->mPos, b->mRadius ))
+			{
+				pairs.insert( ItemPair( std::min( a, b ), std::max( a, b )));
+			}
+		}
+	}
+	
+	errorCheck( pairs.size() > 0 );
+	
+	std::vector< ItemPair > found;
+	auto addPair = [&found]( OctItem* a, OctItem* b )
+	{
+		found.push_back( ItemPair( std::min( a, b ), std::max( a, b )));
+		return( true );
+	};
+	auto verifyPairs = [&found, &pairs]()
+	{
+		std::set< ItemPair > foundSet( found.begin(), found.end() );
+		errorCheck( foundSet.size() == found.size() );
+		errorCheck( foundSet == pairs );
+		found.clear();
+	};
+	
+	octTree< OctItem* > tree( minSize, maxSize, .25 );
+	octTree< OctItem*, HashItemIndex< OctItem* >, CapacitySplitPolicy > capacityTree( minSize, maxSize, .25, 8 );
+	looseOctTree< OctItem* > looseTree( minSize, maxSize, .25, 2, 4 );
+	for( OctItem* item : octItems )
+	{
+		tree.add( item, item->mPos, item->mRadius );
+		capacityTree.add( item, item->mPos, item->mRadius );
+		looseTree.add( item, item->mPos, item->mRadius );
+	}
+	
+	tree.forEachOverlappingPair( addPair );
+	verifyPairs();
+	
+	capacityTree.forEachOverlappingPair( addPair );
+	verifyPairs();
+	
+	looseTree.forEachOverlappingPair( addPair );
+	verifyPairs();
+	
+	// small tasks so the walk is split up
+	ThreadPool pool( 4 );
+	std::mutex foundLock;
+	tree.forEachOverlappingPairParallel( pool, [&]( OctItem* a, OctItem* b )
+	{
+		std::lock_guard< std::mutex > lock( foundLock );
+		addPair( a, b );
+	}, 16 );
+	verifyPairs();
+	
+	// early exit
+	int32 numVisited = 0;
+	tree.forEachOverlappingPair( [&numVisited]( OctItem*, OctItem* )
+	{
+		++numVisited;
+		return( numVisited < 3 );
+	} );
+	errorCheck( numVisited == 3 );
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+// join of two trees with different bounds and voxel sizes
+void testOctTreeJoin()
+{
+	typedef std::pair< OctItem*, OctItem* > ItemPair;
+	
+	octTree< OctItem* > treeA( vec3( -8, -8, -8 ), vec3( 8, 8, 8 ), .25 );
+	octTree< OctItem*, HashItemIndex< OctItem* >, CapacitySplitPolicy > treeB(
+		vec3( -4, -6, -2 ), vec3( 12, 10, 14 ), .5, 4 );
+	
+	srand( 18 );
+	std::vector< OctItem* > itemsA;
+	std::vector< OctItem* > itemsB;
+	
+	// on the max side of treeA's root
+	itemsA.push_back( new OctItem( vec3( 7.5, 7.5, 7.5 ), .5 ));
+	itemsB.push_back( new OctItem( vec3( 7.75, 7.75, 7.75 ), .25 ));
+	for( int32 i=0; i<1000; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		itemsA.push_back( new OctItem( p, randFloat( .05, .5 )));
+		
+		vec3 p2( randFloat( -3, 11 ), randFloat( -5, 9 ), randFloat( -1, 13 ));
+		itemsB.push_back( new OctItem( p2, randFloat( .05, .5 )));
+	}
+	
+	for( OctItem* item : itemsA )
+	{
+		treeA.add( item, item->mPos, item->mRadius );
+	}
+	
+	for( OctItem* item : itemsB )
+	{
+		treeB.add( item, item->mPos, item->mRadius );
+	}
+	
+	std::set< ItemPair > pairs;
+	for( OctItem* a : itemsA )
+	{
+		for( OctItem* b : itemsB )
+		{
+			if (spheresOverlap( a->mPos, a->mRadius, b->mPos, b->mRadius ))
+			{
+				pairs.insert( ItemPair( a, b ));
+			}
+		}
+	}
+	
+	errorCheck( pairs.size() > 0 );
+	
+	std::vector< ItemPair > found;
+	spatialJoin( treeA, treeB, [&found]( OctItem* a, OctItem* b )
+	{
+		found.push_back( ItemPair( a, b ));
+		return( true );
+	} );
+	
+	std::set< ItemPair > foundSet( found.begin(), found.end() );
+	errorCheck( foundSet.size() == found.size() );
+	errorCheck( foundSet == pairs );
+	
+	// either order
+	found.clear();
+	spatialJoin( treeB, treeA, [&found]( OctItem* b, OctItem* a )
+	{
+		found.push_back( ItemPair( a, b ));
+		return( true );
+	} );
+	
+	foundSet = std::set< ItemPair >( found.begin(), found.end() );
+	errorCheck( foundSet.size() == found.size() );
+	errorCheck( foundSet == pairs );
+	
+	for( OctItem* item : itemsA )
+	{
+		delete item;
+	}
+	
+	for( OctItem* item : itemsB )
+	{
+		delete item;
+	}
+}
+
+// swept sphere hits match testing every item, with and without item velocities
+void testOctTreeSweep()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	octTree< OctItem* > tree( minSize, maxSize, .25 );
+	
+	srand( 19 );
+	std::vector< OctItem* > octItems;
+	std::vector< vec3 > velocities;
+	for( int32 i=0; i<1000; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		OctItem* item = new OctItem( p, randFloat( .05, .5 ));
+		octItems.push_back( item );
+		velocities.push_back( kOrigin3 );
+		tree.add( item, item->mPos, item->mRadius );
+	}
+	
+	QueryMailbox mailbox;
+	for( int32 pass=0; pass<2; ++pass )
+	{
+		if (pass == 1)
+		{
+			// half the items move
+			for( size_t i=0; i<octItems.size(); i+=2 )
+			{
+				velocities[ i ] = vec3( randFloat( -2, 2 ), randFloat( -2, 2 ), randFloat( -2, 2 ));
+				bool set = tree.setVelocity( octItems[ i ], velocities[ i ] );
+				errorCheck( set );
+			}
+		}
+		
+		for( int32 i=0; i<50; ++i )
+		{
+			vec3 p( randFloat( -6, 6 ), randFloat( -6, 6 ), randFloat( -6, 6 ));
+			vec3 v( randFloat( -4, 4 ), randFloat( -4, 4 ), randFloat( -4, 4 ));
+			float64 radius = .3;
+			
+			std::vector< SweepHit< OctItem* > > hits;
+			tree.sweepSphere( p, v, radius, hits );
+			
+			std::set< std::pair< OctItem*, float64 > > expected;
+			for( size_t j=0; j<octItems.size(); ++j )
+			{
+				OctItem* item = octItems[ j ];
+				float64 t = getCollision( p, v, item->mPos, velocities[ j ], radius + item->mRadius );
+				if (t >= 0)
+				{
+					expected.insert( std::make_pair( item, t ));
+				}
+			}
+			
+			std::set< std::pair< OctItem*, float64 > > found;
+			for( size_t j=0; j<hits.size(); ++j )
+			{
+				errorCheck( j == 0 || hits[ j - 1 ].mT <= hits[ j ].mT );
+				found.insert( std::make_pair( hits[ j ].mItem, hits[ j ].mT ));
+			}
+			
+			errorCheck( found.size() == hits.size() );
+			errorCheck( found == expected );
+			
+			// same hits with the caller's mailbox
+			std::vector< SweepHit< OctItem* > > hits2;
+			tree.sweepSphere( p, v, radius, mailbox, hits2 );
+			errorCheck( hits2.size() == hits.size() );
+			for( size_t j=0; j<hits.size(); ++j )
+			{
+				errorCheck( hits2[ j ].mItem == hits[ j ].mItem && hits2[ j ].mT == hits[ j ].mT );
+			}
+		}
+	}
+	
+	// a fast item passes through a still sphere within one step
+	OctItem bullet( vec3( -6, 0, 0 ), .1 );
+	tree.add( &bullet, bullet.mPos, bullet.mRadius );
+	tree.setVelocity( &bullet, vec3( 12, 0, 0 ));
+	
+	std::vector< SweepHit< OctItem* > > hits;
+	tree.sweepSphere( vec3( 0, 7.5, 0 ), kOrigin3, .25, hits );
+	for( const SweepHit< OctItem* >& hit : hits )
+	{
+		errorCheck( hit.mItem != &bullet );
+	}
+	
+	hits.clear();
+	tree.sweepSphere( vec3( 0, .2, 0 ), kOrigin3, .25, hits );
+	bool bulletHit = false;
+	for( const SweepHit< OctItem* >& hit : hits )
+	{
+		if (hit.mItem == &bullet)
+		{
+			bulletHit = true;
+			errorCheck( hit.mT > .4 && hit.mT < .5 );
+		}
+	}
+	errorCheck( bulletHit );
+	
+	// the search widens only while the bullet is fast
+	errorCheck( tree.getMaxItemSpeed() == 12 );
+	tree.setVelocity( &bullet, kOrigin3 );
+	float64 slowSpeed = tree.getMaxItemSpeed();
+	errorCheck( slowSpeed > 0 && slowSpeed < 12 );
+	tree.setVelocity( &bullet, vec3( 0, 0, 20 ));
+	errorCheck( tree.getMaxItemSpeed() == 20 );
+	tree.remove( &bullet );
+	errorCheck( tree.getMaxItemSpeed() == slowSpeed );
+	
+	for( OctItem* item : octItems )
+	{
+		tree.remove( item );
+	}
+	errorCheck( tree.getMaxItemSpeed() == 0 );
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+// child masks match testing the children one at a time
+void testOctTreeChildMask()
+{
+	Box3 bounds( vec3( -8, -4, 2 ), vec3( 8, 12, 6 ));
+	Box3 children[ 8 ];
+	split8( bounds, children );
+	
+	srand( 20 );
+	for( int32 i=0; i<10000; ++i )
+	{
+		vec3 p1( randFloat( -10, 10 ), randFloat( -6, 14 ), randFloat( 0, 8 ));
+		vec3 p2( randFloat( -10, 10 ), randFloat( -6, 14 ), randFloat( 0, 8 ));
+		float64 radius = (i % 4 == 0) ? 0 : randFloat( 0, 2 );
+		
+		// axis aligned and still beams
+		if (i % 5 == 0)
+		{
+			p2[ i % 3 ] = p1[ i % 3 ];
+		}
+		else if (i % 7 == 0)
+		{
+			p2 = p1;
+		}
+		
+		Box3 box( p1, radius );
+		uint32 boxMask = 0;
+		uint32 beamMask = 0;
+		for( int32 c=0; c<8; ++c )
+		{
+			boxMask |= children[ c ].intersects( box ) ? (1 << c) : 0;
+			beamMask |= (children[ c ].getRayEntry( p1, p2, radius ) >= 0) ? (1 << c) : 0;
+		}
+		
+		errorCheck( getChildMask( children[ 0 ], children[ 7 ], box ) == boxMask );
+		errorCheck( getChildMask( children[ 0 ], children[ 7 ], p1, p2, radius ) == beamMask );
+	}
+	
+	// a packet's rays get the same children as one at a time
+	for( int32 i=0; i<1000; ++i )
+	{
+		const int32 numRays = 7;
+		vec3 p1s[ numRays ];
+		vec3 p2s[ numRays ];
+		float64 radii[ numRays ];
+		for( int32 ray=0; ray<numRays; ++ray )
+		{
+			p1s[ ray ] = vec3( randFloat( -10, 10 ), randFloat( -6, 14 ), randFloat( 0, 8 ));
+			p2s[ ray ] = vec3( randFloat( -10, 10 ), randFloat( -6, 14 ), randFloat( 0, 8 ));
+			radii[ ray ] = randFloat( 0, 2 );
+			if (ray == 3)
+			{
+				p2s[ ray ][ i % 3 ] = p1s[ ray ][ i % 3 ];
+			}
+		}
+		
+		// ray 5 is left out
+		uint32 rayMask = 0x5f;
+		uint32 childRays[ 8 ];
+		getChildRays( children[ 0 ], children[ 7 ], p1s, p2s, radii, numRays, rayMask, childRays );
+		for( int32 ray=0; ray<numRays; ++ray )
+		{
+			uint32 mask = getChildMask( children[ 0 ], children[ 7 ], p1s[ ray ], p2s[ ray ], radii[ ray ] );
+			for( int32 c=0; c<8; ++c )
+			{
+				bool expected = (rayMask & (1 << ray)) && (mask & (1 << c));
+				errorCheck( ((childRays[ c ] >> ray) & 1) == (expected ? 1u : 0u) );
+			}
+		}
+	}
+}
+
+// leaf kernels give the same hits and t as the one item tests
+void testOctTreeLeafKernels()
+{
+	srand( 21 );
+	for( int32 i=0; i<10000; ++i )
+	{
+		size_t count = 1 + (i % 8);
+		float32 x[ 8 ];
+		float32 y[ 8 ];
+		float32 z[ 8 ];
+		float64 radius[ 8 ];
+		for( size_t j=0; j<count; ++j )
+		{
+			x[ j ] = randFloat( -4, 4 );
+			y[ j ] = randFloat( -4, 4 );
+			z[ j ] = randFloat( -4, 4 );
+			radius[ j ] = randFloat( .05, 1 );
+		}
+		
+		vec3 p1( randFloat( -5, 5 ), randFloat( -5, 5 ), randFloat( -5, 5 ));
+		vec3 p2( randFloat( -5, 5 ), randFloat( -5, 5 ), randFloat( -5, 5 ));
+		if (i % 9 == 0)
+		{
+			p2 = p1;
+		}
+		
+		vec3 v = p2 - p1;
+		float64 beamRadius = randFloat( 0, 1 );
+		Box3 box( p1, randFloat( 0, 2 ));
+		vec3 boxMin = box.getMin();
+		vec3 boxMax = box.getMax();
+		
+		float64 ts[ 8 ];
+		uint32 boxMask = getBoxHits( x, y, z, radius, count, boxMin, boxMax );
+		uint32 beamMask = getBeamHits( x, y, z, radius, count, p1, v, beamRadius, ts );
+		for( size_t j=0; j<count; ++j )
+		{
+			vec3 p( x[ j ], y[ j ], z[ j ] );
+			bool boxHit = box.intersects( Box3( p, radius[ j ] ));
+			errorCheck( ((boxMask >> j) & 1) == (boxHit ? 1u : 0u) );
+			
+			float64 t = getCollision( p1, v, p, beamRadius + radius[ j ] );
+			errorCheck( ((beamMask >> j) & 1) == (t >= 0 ? 1u : 0u) );
+			errorCheck( t < 0 || ts[ j ] == t );
+		}
+		
+		errorCheck( (boxMask >> count) == 0 && (beamMask >> count) == 0 );
+		
+		// the build's SIMD path matches the plain one
+		float64 ts2[ 8 ];
+		errorCheck( getBoxHitsScalar( x, y, z, radius, count, boxMin, boxMax ) == boxMask );
+		errorCheck( getBeamHitsScalar( x, y, z, radius, count, p1, v, beamRadius, ts2 ) == beamMask );
+		for( size_t j=0; j<count; ++j )
+		{
+			errorCheck( ((beamMask >> j) & 1) == 0 || ts2[ j ] == ts[ j ] );
+		}
+	}
+}
+
+// packets find the same items in the same order as single beams
+void testOctTreeRayPacket()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	octTree< OctItem* > tree( minSize, maxSize, .25 );
+	
+	srand( 22 );
+	std::vector< OctItem* > octItems;
+	for( int32 i=0; i<2000; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		OctItem* item = new OctItem( p, randFloat( .05, .5 ));
+		octItems.push_back( item );
+		tree.add( item, item->mPos, item->mRadius );
+	}
+	
+	PacketMailbox mailbox;
+	const int32 packetSizes[] = { 4, 8, 16 };
+	for( int32 numRays : packetSizes )
+	{
+		for( int32 i=0; i<50; ++i )
+		{
+			// a fan of rays from one point, some leaving the tree
+			RayPacket packet;
+			vec3 p1( randFloat( -9, 9 ), randFloat( -9, 9 ), randFloat( -9, 9 ));
+			vec3 target( randFloat( -6, 6 ), randFloat( -6, 6 ), randFloat( -6, 6 ));
+			for( int32 ray=0; ray<numRays; ++ray )
+			{
+				vec3 spread( randFloat( -2, 2 ), randFloat( -2, 2 ), randFloat( -2, 2 ));
+				float64 radius = (ray % 4 == 0) ? 0 : randFloat( 0, .25 );
+				int32 index = packet.add( p1, target + spread, radius );
+				errorCheck( index == ray );
+			}
+			
+			std::vector< OctItem* > found[ RayPacket::kMaxRays ];
+			tree.getItems( packet, found );
+			
+			// same with the caller's mailbox
+			std::vector< OctItem* > found2[ RayPacket::kMaxRays ];
+			tree.forEachItem( packet, mailbox, [&found2]( int32 ray, OctItem* item )
+			{
+				found2[ ray ].push_back( item );
+				return( true );
+			} );
+			
+			for( int32 ray=0; ray<numRays; ++ray )
+			{
+				std::vector< OctItem* > expected;
+				tree.getItems( packet.mP1[ ray ], packet.mP2[ ray ], packet.mRadius[ ray ], expected );
+				errorCheck( found[ ray ] == expected );
+				errorCheck( found2[ ray ] == expected );
+			}
+		}
+	}
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+// batch results match getItems() query by query
+void testOctTreeBatch()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	octTree< OctItem* > tree( minSize, maxSize, .25 );
+	
+	srand( 23 );
+	std::vector< OctItem* > octItems;
+	
+	// against the max side of the root
+	octItems.push_back( new OctItem( vec3( 7.5, 7.5, 7.5 ), .5 ));
+	for( int32 i=0; i<2000; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		OctItem* item = new OctItem( p, randFloat( .05, .5 ));
+		octItems.push_back( item );
+		tree.add( item, item->mPos, item->mRadius );
+	}
+	tree.add( octItems[ 0 ], octItems[ 0 ]->mPos, octItems[ 0 ]->mRadius );
+	
+	// more than one group, some partly or fully outside the tree
+	std::vector< ItemQuery > queries;
+	queries.push_back( ItemQuery( vec3( 8, 8, 8 ), .25 ));
+	for( int32 i=0; i<1000; ++i )
+	{
+		vec3 p( randFloat( -10, 10 ), randFloat( -10, 10 ), randFloat( -10, 10 ));
+		queries.push_back( ItemQuery( p, randFloat( 0, 2 )));
+	}
+	
+	BatchResult< OctItem* > result;
+	tree.getItemsBatch( queries, result );
+	errorCheck( result.getNumQueries() == queries.size() );
+	
+	size_t numFound = 0;
+	for( size_t i=0; i<queries.size(); ++i )
+	{
+		std::set< OctItem* > expected;
+		tree.getItems( queries[ i ].mPos, queries[ i ].mRadius, expected );
+		
+		OctItem* const* items = result.getItems( i );
+		std::set< OctItem* > found( items, items + result.getNumItems( i ));
+		errorCheck( found.size() == result.getNumItems( i ));
+		errorCheck( found == expected );
+		numFound += found.size();
+	}
+	
+	errorCheck( numFound > 0 );
+	errorCheck( numFound == result.mItems.size() );
+	
+	// empty batch
+	tree.getItemsBatch( std::vector< ItemQuery >(), result );
+	errorCheck( result.getNumQueries() == 0 && result.mItems.size() == 0 );
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+// compares each query's items with its single query
+template< typename TQuery, typename F >
+static void checkQueryParallel( const octTree< OctItem* >& tree, ThreadPool& pool,
+	const std::vector< TQuery >& queries, F single )
+{
+	BatchResult< OctItem* > result;
+	tree.queryParallel( queries, pool, result );
+	errorCheck( result.getNumQueries() == queries.size() );
+	
+	size_t numFound = 0;
+	for( size_t i=0; i<queries.size(); ++i )
+	{
+		std::vector< OctItem* > expected;
+		single( queries[ i ], expected );
+		
+		OctItem* const* items = result.getItems( i );
+		errorCheck( std::vector< OctItem* >( items, items + result.getNumItems( i )) == expected );
+		numFound += expected.size();
+	}
+	
+	errorCheck( numFound > 0 );
+	errorCheck( numFound == result.mItems.size() );
+}
+
+void testOctTreeQueryParallel()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	
+	octTree< OctItem* > tree( minSize, maxSize, .25 );
+	
+	srand( 24 );
+	std::vector< OctItem* > octItems;
+	for( int32 i=0; i<2000; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		OctItem* item = new OctItem( p, randFloat( .05, .5 ));
+		octItems.push_back( item );
+		tree.add( item, item->mPos, item->mRadius );
+	}
+	
+	// several tasks each, some queries outside the tree
+	std::vector< ItemQuery > spheres;
+	std::vector< BeamQuery > beams;
+	std::vector< NearestQuery > nearest;
+	for( int32 i=0; i<1000; ++i )
+	{
+		vec3 p( randFloat( -10, 10 ), randFloat( -10, 10 ), randFloat( -10, 10 ));
+		vec3 p2( randFloat( -10, 10 ), randFloat( -10, 10 ), randFloat( -10, 10 ));
+		spheres.push_back( ItemQuery( p, randFloat( 0, 2 )));
+		beams.push_back( BeamQuery( p, p2, randFloat( 0, .5 )));
+		nearest.push_back( NearestQuery( p, rand() % 8, randFloat( 1, 4 )));
+	}
+	
+	ThreadPool pool( 4 );
+	checkQueryParallel( tree, pool, spheres, [&tree]( const ItemQuery& query, std::vector< OctItem* >& out )
+	{
+		tree.getItems( query.mPos, query.mRadius, out );
+	} );
+	
+	checkQueryParallel( tree, pool, beams, [&tree]( const BeamQuery& query, std::vector< OctItem* >& out )
+	{
+		tree.getItems( query.mP1, query.mP2, query.mRadius, out );
+	} );
+	
+	checkQueryParallel( tree, pool, nearest, [&tree]( const NearestQuery& query, std::vector< OctItem* >& out )
+	{
+		tree.getNearest( query.mPos, query.mK, query.mMaxDist, out );
+	} );
+	
+	// parallel queries and batches on one tree can overlap
+	BatchResult< OctItem* > expected;
+	BatchResult< OctItem* > expectedBatch;
+	tree.queryParallel( spheres, pool, expected );
+	tree.getItemsBatch( spheres, expectedBatch );
+	
+	BatchResult< OctItem* > results[ 2 ];
+	BatchResult< OctItem* > batch;
+	std::thread other( [&tree, &pool, &spheres, &results, &batch]()
+	{
+		tree.queryParallel( spheres, pool, results[ 1 ] );
+		tree.getItemsBatch( spheres, batch );
+	} );
+	tree.queryParallel( spheres, pool, results[ 0 ] );
+	other.join();
+	for( const BatchResult< OctItem* >& found : results )
+	{
+		errorCheck( found.mOffsets == expected.mOffsets && found.mItems == expected.mItems );
+	}
+	errorCheck( batch.mOffsets == expectedBatch.mOffsets && batch.mItems == expectedBatch.mItems );
+	
+	// empty batch
+	BatchResult< OctItem* > result;
+	tree.queryParallel( std::vector< ItemQuery >(), pool, result );
+	errorCheck( result.getNumQueries() == 0 && result.mItems.size() == 0 );
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
+
+void testOctTreeConcurrent()
+{
+	vec3 minSize( -8, -8, -8 );
+	vec3 maxSize( 8, 8, 8 );
+	Box3 all( minSize, maxSize );
+	
+	concurrentOctTree< OctItem* > tree( minSize, maxSize, .25 );
+	concurrentOctTree< OctItem* >::Reader reader( tree );
+	
+	srand( 25 );
+	std::vector< OctItem* > octItems;
+	for( int32 i=0; i<600; ++i )
+	{
+		vec3 p( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+		octItems.push_back( new OctItem( p, randFloat( .05, .5 )));
+	}
+	
+	// first 500 in the tree, the rest swap in and out
+	const size_t numInTree = 500;
+	for( size_t i=0; i<numInTree; ++i )
+	{
+		tree.add( octItems[ i ], octItems[ i ]->mPos, octItems[ i ]->mRadius );
+	}
+	
+	// writes show up at publish()
+	std::vector< OctItem* > found;
+	reader.getItems( kOrigin3, 8, found );
+	errorCheck( found.size() == 0 );
+	
+	tree.publish();
+	reader.getItems( kOrigin3, 8, found );
+	errorCheck( found.size() == numInTree );
+	
+	// readers check every version they see is whole
+	std::atomic< bool > done( false );
+	std::atomic< int32 > numReads( 0 );
+	std::vector< std::thread > threads;
+	for( int32 i=0; i<3; ++i )
+	{
+		threads.push_back( std::thread( [&tree, &all, &done, &numReads, numInTree]()
+		{
+			concurrentOctTree< OctItem* >::Reader threadReader( tree );
+			while( done == false )
+			{
+				threadReader.read( [&]( const octTree< OctItem* >& version, QueryMailbox& mailbox )
+				{
+					size_t count = 0;
+					version.forEachItem( all, mailbox, [&count]( OctItem* const& )
+					{
+						count++;
+						return( true );
+					} );
+					
+					errorCheck( count == numInTree );
+					errorCheck( version.getNumItems() == numInTree );
+				} );
+				
+				std::vector< OctItem* > nearest;
+				threadReader.getNearest( kOrigin3, 4, 20, nearest );
+				errorCheck( nearest.size() == 4 );
+				numReads++;
+			}
+		} ));
+	}
+	
+	// writer moves items and swaps one in for one out per version
+	size_t numOut = octItems.size() - numInTree;
+	for( int32 round=0; round<200; ++round )
+	{
+		for( int32 i=0; i<20; ++i )
+		{
+			OctItem* item = octItems[ rand() % numInTree ];
+			item->mPos = vec3( randFloat( -7, 7 ), randFloat( -7, 7 ), randFloat( -7, 7 ));
+			errorCheck( tree.update( item, item->mPos, item->mRadius ));
+		}
+		
+		size_t in = numInTree + rand() % numOut;
+		size_t out = rand() % numInTree;
+		errorCheck( tree.remove( octItems[ out ] ));
+		tree.add( octItems[ in ], octItems[ in ]->mPos, octItems[ in ]->mRadius );
+		std::swap( octItems[ in ], octItems[ out ] );
+		
+		tree.tick();
+		tree.publish();
+	}
+	
+	done = true;
+	for( std::thread& thread : threads )
+	{
+		thread.join();
+	}
+	
+	errorCheck( numReads > 0 );
+	
+	// the published version matches the write tree
+	for( int32 i=0; i<100; ++i )
+	{
+		vec3 p( randFloat( -8, 8 ), randFloat( -8, 8 ), randFloat( -8, 8 ));
+		float64 radius = randFloat( 0, 3 );
+		std::vector< OctItem* > expected;
+		tree.getWriteTree().getItems( p, radius, expected );
+		found.clear();
+		reader.getItems( p, radius, found );
+		errorCheck( found == expected );
+	}
+	
+	// with every slot taken, a new reader waits for one to free up
+	std::vector< std::unique_ptr< concurrentOctTree< OctItem* >::Reader > > readers;
+	for( int32 i=1; i<EpochManager::kMaxReaders; ++i )
+	{
+		readers.emplace_back( new concurrentOctTree< OctItem* >::Reader( tree ));
+	}
+	
+	std::atomic< bool > waited( false );
+	std::thread waiter( [&tree, &waited, numInTree]()
+	{
+		concurrentOctTree< OctItem* >::Reader threadReader( tree );
+		errorCheck( waited );
+		
+		// queries without a mailbox are fine in read() too
+		threadReader.read( [&]( const octTree< OctItem* >& version, QueryMailbox& )
+		{
+			std::vector< OctItem* > items;
+			version.getItems( kOrigin3, 8, items );
+			errorCheck( items.size() == numInTree );
+		} );
+	} );
+	
+	std::this_thread::sleep_for( std::chrono::milliseconds( 10 ));
+	waited = true;
+	readers.pop_back();
+	waiter.join();
+	
+	for( OctItem* item : octItems )
+	{
+		delete item;
+	}
+}
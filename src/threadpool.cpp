@@ -0,0 +1,165 @@
+//
+//  threadpool.cpp
+//
+
+#include "threadpool.h"
+#include "Platform.h"
+
+// worker index of the current thread, per pool
+static thread_local const ThreadPool* tPool = nullptr;
+static thread_local int32 tWorkerIndex = -1;
+
+ThreadPool::ThreadPool( int32 numThreads )
+{
+	if (numThreads <= 0)
+	{
+		numThreads = static_cast< int32 >( std::thread::hardware_concurrency() );
+		if (numThreads <= 0)
+		{
+			numThreads = 1;
+		}
+	}
+
+	mNumQueued = 0;
+	mStop = false;
+
+	// last queue is shared by threads outside the pool
+	for( int32 i=0; i<numThreads + 1; ++i )
+	{
+		mQueues.push_back( std::unique_ptr< WorkQueue >( new WorkQueue() ));
+	}
+
+	for( int32 i=0; i<numThreads; ++i )
+	{
+		mThreads.push_back( std::thread( &ThreadPool::workerLoop, this, i ));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard< std::mutex > lock( mWakeMutex );
+		mStop = true;
+	}
+
+	mWake.notify_all();
+	for( std::thread& thread : mThreads )
+	{
+		thread.join();
+	}
+}
+
+int32 ThreadPool::getNumThreads() const
+{
+	return( static_cast< int32 >( mThreads.size() ));
+}
+
+int32 ThreadPool::getWorkerIndex() const
+{
+	if (tPool == this)
+	{
+		return( tWorkerIndex );
+	}
+
+	return( getNumThreads() );
+}
+
+void ThreadPool::run( std::function< void() > task, TaskGroup& group )
+{
+	group.mNumPending++;
+
+	WorkQueue& queue = *mQueues[ getWorkerIndex() ];
+	{
+		std::lock_guard< std::mutex > lock( queue.mMutex );
+		Task t;
+		t.mFunc = std::move( task );
+		t.mGroup = &group;
+		queue.mTasks.push_back( std::move( t ));
+	}
+
+	{
+		std::lock_guard< std::mutex > lock( mWakeMutex );
+		mNumQueued++;
+	}
+
+	mWake.notify_one();
+}
+
+void ThreadPool::wait( TaskGroup& group )
+{
+	int32 index = getWorkerIndex();
+	while( group.mNumPending > 0 )
+	{
+		if (runOne( index ) == false)
+		{
+			// remaining tasks are running on other threads
+			std::this_thread::yield();
+		}
+	}
+}
+
+bool ThreadPool::runOne( int32 index )
+{
+	Task task;
+	bool found = false;
+
+	// newest task from our own queue
+	{
+		WorkQueue& queue = *mQueues[ index ];
+		std::lock_guard< std::mutex > lock( queue.mMutex );
+		if (queue.mTasks.size() > 0)
+		{
+			task = std::move( queue.mTasks.back() );
+			queue.mTasks.pop_back();
+			found = true;
+		}
+	}
+
+	// oldest task from someone else
+	int32 numQueues = static_cast< int32 >( mQueues.size() );
+	for( int32 i=1; i<numQueues && found == false; ++i )
+	{
+		WorkQueue& queue = *mQueues[ (index + i) % numQueues ];
+		std::lock_guard< std::mutex > lock( queue.mMutex );
+		if (queue.mTasks.size() > 0)
+		{
+			task = std::move( queue.mTasks.front() );
+			queue.mTasks.pop_front();
+			found = true;
+		}
+	}
+
+	if (found == false)
+	{
+		return( false );
+	}
+
+	{
+		std::lock_guard< std::mutex > lock( mWakeMutex );
+		mNumQueued--;
+	}
+
+	task.mFunc();
+	errorCheck( task.mGroup->mNumPending > 0 );
+	task.mGroup->mNumPending--;
+
+	return( true );
+}
+
+void ThreadPool::workerLoop( int32 index )
+{
+	tPool = this;
+	tWorkerIndex = index;
+
+	while( mStop == false )
+	{
+		if (runOne( index ) == false)
+		{
+			std::unique_lock< std::mutex > lock( mWakeMutex );
+			mWake.wait( lock, [this]()
+			{
+				return( mNumQueued > 0 || mStop );
+			} );
+		}
+	}
+}
@@ -0,0 +1,92 @@
+//
+//  threadpool.h
+//
+
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+#include "Types.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// tasks that are waited on together
+class TaskGroup
+{
+public:
+
+	TaskGroup()
+	{
+		mNumPending = 0;
+	}
+
+	std::atomic< int32 > mNumPending;
+};
+
+// work stealing thread pool
+// every worker has its own task queue. a worker takes the newest task
+// from its own queue and steals the oldest task from the others when
+// it runs out. tasks run from a worker go to that worker's queue, so
+// recursive work stays local until someone is idle enough to steal it.
+class ThreadPool
+{
+public:
+
+	// 0 threads = one per hardware thread
+	ThreadPool( int32 numThreads = 0 );
+	~ThreadPool();
+
+	int32 getNumThreads() const;
+
+	void run( std::function< void() > task, TaskGroup& group );
+
+	// returns when all tasks in group are done
+	// the waiting thread runs tasks meanwhile, so waiting inside a task is fine
+	void wait( TaskGroup& group );
+
+	// index of the calling worker thread, or getNumThreads() for
+	// any other thread. stable while a task runs, so it can index
+	// per worker scratch space
+	int32 getWorkerIndex() const;
+
+private:
+
+	class Task
+	{
+	public:
+
+		std::function< void() > mFunc;
+		TaskGroup* mGroup;
+	};
+
+	class WorkQueue
+	{
+	public:
+
+		std::mutex mMutex;
+		std::deque< Task > mTasks;
+	};
+
+	void workerLoop( int32 index );
+
+	// run one task, own queue first, then steal
+	bool runOne( int32 index );
+
+	std::vector< std::unique_ptr< WorkQueue > > mQueues;
+	std::vector< std::thread > mThreads;
+
+	// idle workers sleep on mWake until a task is queued
+	// mNumQueued only changes under mWakeMutex, so no wakeup is lost
+	std::mutex mWakeMutex;
+	std::condition_variable mWake;
+	int32 mNumQueued;
+	std::atomic< bool > mStop;
+};
+
+#endif
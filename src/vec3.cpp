@@ -697,6 +697,11 @@ float32 Frustum::dist( const vec3& p ) const
 	return( dist );
 }
 
+const Plane* Frustum::getPlanes() const
+{
+	return( mPlanes );
+}
+
 float32 getPerspectiveAspect( float32 xDegs, float32 yDegs )
 {    
     float32 aspect = tan( degreesToRadians( xDegs / 2 ) ) / tan( degreesToRadians( yDegs / 2 ));
@@ -401,9 +401,14 @@ class Frustum
 {
 public:
 	
+	static constexpr int32 kNumPlanes = 4;
+	
 	Frustum( const Plane& left, const Plane& right, const Plane& top, const Plane& bottom );
 	float32 dist( const vec3& p ) const;
 	
+	// planes face inward
+	const Plane* getPlanes() const;
+	
 private:
 	Plane mPlanes[ 4 ];
 };